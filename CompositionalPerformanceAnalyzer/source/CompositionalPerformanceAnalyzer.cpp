@@ -9,6 +9,9 @@
 #include "pattern/Pipeline.hpp"
 #include "pattern/TaskPool.hpp"
 
+#include "tests/MapReduceTests.hpp"
+#include "tests/SchedulerTests.hpp"
+
 #include <iostream>
 #include <thread>
 #include <vector>
@@ -16,7 +19,10 @@
 #include <mpi.h>
 
 int main(int argument_count, char** arguments) {
-	MPI_Init(&argument_count, &arguments);
+	// The patterns call MPI from their worker threads, MapReduceLocalV receives on several of
+	// them at once if the library allows it.
+	int provided_thread_support = MPI_THREAD_SINGLE;
+	MPI_Init_thread(&argument_count, &arguments, MPI_THREAD_MULTIPLE, &provided_thread_support);
 
 	std::cout << "Working with a hardware concurrency of: " << std::thread::hardware_concurrency() << std::endl;
 
@@ -31,8 +37,7 @@ int main(int argument_count, char** arguments) {
 
 	auto tp = TaskPool<std::vector<int>, std::vector<int>>::create(qs_w, 4);
 
-	auto pipe_1 = Pipeline< std::vector<int>, std::vector<int>, std::vector<int>>::create(inc_w, tp);
-	auto pipe_2 = Pipeline< std::vector<int>, std::vector<int>, std::vector<int>>::create(pipe_1, nop_w);
+	auto pipe = Pipeline< std::vector<int>, std::vector<int>, std::vector<int>, std::vector<int>>::create(inc_w, tp, nop_w);
 
 	std::vector<std::future<std::vector<int>>> inputs{};
 	for (auto i = 0; i < 10; i++) {
@@ -50,17 +55,38 @@ int main(int argument_count, char** arguments) {
 	std::vector<std::future<std::vector<int>>> outputs{};
 	std::vector<std::vector<int>> unpacked_outputs{};
 
-	pipe_2->Init();
+	pipe->Init();
 
 	for (auto& input : inputs) {
-		outputs.emplace_back(pipe_2->Compute(std::move(input)));
+		outputs.emplace_back(pipe->Compute(std::move(input)));
 	}
 
 	for (auto& output : outputs) {
 		unpacked_outputs.emplace_back(output.get());
 	}
 
-	pipe_2->Dispose();
+	pipe->Dispose();
+
+	if (!test_worker_slots_bound_concurrency() || !test_async_submissions_bound_concurrency()
+		|| !test_executor_counts_future_inputs() || !test_batch_spreads_over_workers()
+		|| !test_exceptions_reach_the_caller() || !test_batch_does_not_wait_for_its_input()) {
+		std::cout << "Scheduler tests failed" << std::endl;
+
+		MPI_Finalize();
+
+		return 1;
+	}
+
+	if (!test_serializers_round_trip() || !test_tree_reduce_covers_all_ranks()
+		|| !test_radix_sort_matches_std_sort() || !test_partitioners_are_deterministic()
+		|| !test_spilled_collection_round_trips() || !test_combiner_keeps_results()
+		|| !test_map_reduce_counts_words() || !test_streaming_counts_words()) {
+		std::cout << "MapReduce tests failed" << std::endl;
+
+		MPI_Finalize();
+
+		return 1;
+	}
 
 	std::cout << "Finished" << std::endl;
 
@@ -1,6 +1,13 @@
 #include "Globals.hpp"
 #include <cstring>
 
+#ifndef WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 uint64_t getTimeNow() noexcept {
 	auto now = std::chrono::time_point_cast<std::chrono::nanoseconds>(std::chrono::high_resolution_clock::now());
 	auto count = now.time_since_epoch().count();
@@ -17,31 +24,85 @@ uint64_t getProcessorNow() noexcept {
 #endif
 }
 
-std::tuple<char*, unsigned long long> getFileData(std::string filename) {
-	auto dummy = std::make_tuple(nullptr, -1);
+MappedFile::MappedFile(const std::string& filename) {
+#ifndef WIN32
+	auto descriptor = open(filename.c_str(), O_RDONLY);
+
+	if (descriptor < 0) {
+		return;
+	}
+
+	struct stat status {};
+
+	if (fstat(descriptor, &status) == 0 && status.st_size > 0) {
+		auto* address = mmap(nullptr, static_cast<size_t>(status.st_size), PROT_READ, MAP_PRIVATE, descriptor, 0);
+
+		if (address != MAP_FAILED) {
+			mapping = static_cast<const char*>(address);
+			length = static_cast<unsigned long long>(status.st_size);
+		}
+	}
 
+	// The mapping stays valid after the descriptor is closed.
+	close(descriptor);
+#else
 	std::ifstream input(filename, std::ios::in | std::ios::binary | std::ios::ate);
+
 	if (!input.good()) {
-		std::cerr << "File is not good!" << std::endl;
-		return dummy;
+		return;
 	}
 
 	auto position = input.tellg();
 
-	if (position < 0) {
-		std::cerr << "tellg returned < 0!" << std::endl;
-		return dummy;
+	if (position <= 0) {
+		return;
 	}
 
-	std::vector<char> characters(position);
-	char* raw_data = characters.data();
+	contents.resize(static_cast<size_t>(position));
 
 	input.seekg(0, std::ios::beg);
-	input.read(raw_data, position);
+	input.read(contents.data(), position);
+
+	mapping = contents.data();
+	length = contents.size();
+#endif
+}
+
+MappedFile::~MappedFile() {
+#ifndef WIN32
+	if (mapping != nullptr) {
+		munmap(const_cast<char*>(mapping), static_cast<size_t>(length));
+	}
+#endif
+}
+
+void MappedFile::AdviseSequential() const noexcept {
+#ifndef WIN32
+	if (mapping != nullptr) {
+		madvise(const_cast<char*>(mapping), static_cast<size_t>(length), MADV_SEQUENTIAL);
+	}
+#endif
+}
 
-	if ((characters[0] != 'B') || (characters[1] != 'M')) {
-		std::cerr << "File didn't start with BM! It started with: " << characters[0] << characters[1] << std::endl;
-		return dummy;
+BitmapView getFileData(std::string filename) {
+	auto file = std::make_shared<MappedFile>(filename);
+
+	if (!file->good()) {
+		std::cerr << "File is not good!" << std::endl;
+		return BitmapView();
+	}
+
+	// The file header ends at 14 bytes, the info header with the compression at 54.
+	if (file->size() < 54) {
+		std::cerr << "File is too small for a bitmap header!" << std::endl;
+		return BitmapView();
+	}
+
+	const char* raw_data = file->data();
+
+	if ((raw_data[0] != 'B') || (raw_data[1] != 'M')) {
+		std::cerr << "File didn't start with BM! It started with: " << raw_data[0] << raw_data[1] << std::endl;
+		return BitmapView();
 	}
 
 	unsigned short bpp;
@@ -49,7 +110,7 @@ std::tuple<char*, unsigned long long> getFileData(std::string filename) {
 
 	if (bpp != 24) {
 		std::cerr << "bpp is not 24! It is " << bpp << std::endl;
-		return dummy;
+		return BitmapView();
 	}
 
 	unsigned int comp;
@@ -57,45 +118,46 @@ std::tuple<char*, unsigned long long> getFileData(std::string filename) {
 
 	if (comp != 0) {
 		std::cerr << "comp is not 0! It is: " << comp << std::endl;
-		return dummy;
+		return BitmapView();
 	}
 
 	unsigned int offset;
 	std::memcpy(&offset, raw_data + 10, sizeof(unsigned int));
 
-	auto len = characters.size() - offset;
+	if (offset > file->size()) {
+		std::cerr << "The pixel offset " << offset << " is behind the end of the file!" << std::endl;
+		return BitmapView();
+	}
 
-	char* raw_ptr = new char[len];
+	auto len = file->size() - offset;
 
-	std::memcpy(raw_ptr, characters.data() + offset, len);
+	file->AdviseSequential();
 
-	return std::make_tuple(raw_ptr, len);
+	return BitmapView(file, raw_data + offset, len);
 }
 
-std::tuple<char*, unsigned long long> loadFile(std::string path) {
-	auto dummy = std::make_tuple(nullptr, -1);
-
+BitmapView loadFile(std::string path) {
 	if (!std::filesystem::exists(path)) {
 		std::cout << "Path: " << path << " doesn't exist!" << std::endl;
-		return dummy;
+		return BitmapView();
 	}
 
 	if (std::filesystem::is_empty(path)) {
 		std::cout << "The path: " << path << " is empty." << std::endl;
-		return dummy;
+		return BitmapView();
 	}
 
 	for (const auto& entry : std::filesystem::directory_iterator(path)) {
 		auto str = entry.path().string();
 
-		auto tuple = getFileData(str);
+		auto view = getFileData(str);
 
-		if (std::get<0>(tuple) == nullptr) {
+		if (!view) {
 			continue;
 		}
 
-		return tuple;
+		return view;
 	}
 
-	return dummy;
+	return BitmapView();
 }
@@ -6,6 +6,8 @@
 #include <fstream>
 #include <string>
 #include <iostream>
+#include <memory>
+#include <utility>
 #include <vector>
 
 uint64_t getTimeNow() noexcept;
@@ -17,7 +19,76 @@ T getDuration(const T& begin, const T& end) noexcept {
 	return end - begin;
 }
 
-std::tuple<char*, unsigned long long> getFileData(std::string filename);
+// A read-only mapping of a whole file that is unmapped on destruction. Reading it only pages
+// the file in, so the heap stays untouched however large the file is. Builds without mmap
+// read the file into memory instead.
+class MappedFile {
+	const char* mapping = nullptr;
+	unsigned long long length = 0;
 
-std::tuple<char*, unsigned long long> loadFile(std::string path);
+#ifdef WIN32
+	std::vector<char> contents{};
+#endif
+
+public:
+	explicit MappedFile(const std::string& filename);
+
+	MappedFile(const MappedFile& other) = delete;
+	MappedFile(MappedFile&& other) = delete;
+
+	MappedFile& operator=(const MappedFile& other) = delete;
+	MappedFile& operator=(MappedFile&& other) = delete;
+
+	~MappedFile();
+
+	// Tells the kernel the file is read front to back, so it reads ahead and drops pages early.
+	void AdviseSequential() const noexcept;
+
+	const char* data() const noexcept {
+		return mapping;
+	}
+
+	unsigned long long size() const noexcept {
+		return length;
+	}
+
+	bool good() const noexcept {
+		return mapping != nullptr;
+	}
+};
+
+// The pixel data of a 24-bit bitmap inside its mapped file. The view keeps the mapping alive,
+// the tuple handed to BitmapDecomposerRaw is only valid as long as a view of it exists.
+class BitmapView {
+	std::shared_ptr<MappedFile> file{};
+	const char* pixels = nullptr;
+	unsigned long long length = 0;
+
+public:
+	BitmapView() = default;
+
+	BitmapView(std::shared_ptr<MappedFile> file, const char* pixels, unsigned long long length)
+		: file(std::move(file)), pixels(pixels), length(length) {
+	}
+
+	const char* data() const noexcept {
+		return pixels;
+	}
+
+	unsigned long long size() const noexcept {
+		return length;
+	}
+
+	explicit operator bool() const noexcept {
+		return pixels != nullptr;
+	}
+
+	std::tuple<const char*, unsigned long long> tuple() const noexcept {
+		return std::make_tuple(pixels, length);
+	}
+};
+
+BitmapView getFileData(std::string filename);
+
+BitmapView loadFile(std::string path);
 
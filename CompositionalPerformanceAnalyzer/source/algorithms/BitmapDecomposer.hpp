@@ -3,10 +3,13 @@
 #include "../interfaces/AlgorithmInterface.hpp"
 #include "../Commons.hpp"
 
+#include "../helper/histogram.hpp"
+
 #include <tuple>
 #include <vector>
 #include <string>
 #include <list>
+#include <map>
 #include <fstream>
 #include <sstream>
 #include <cstring>
@@ -54,21 +57,12 @@ protected:
 		unsigned int offset;
 		std::memcpy(&offset, raw_data + 10, sizeof(unsigned int));
 
-		std::vector<size_t> blue_histogram(256);
-		std::vector<size_t> green_histogram(256);
-		std::vector<size_t> red_histogram(256);
-
-		const char* const pixel = raw_data + offset;
-
-		for (int i = 0; i < characters.size() - offset; i += 3) {
-			unsigned char blue = static_cast<unsigned char>(pixel[i]);
-			unsigned char green = static_cast<unsigned char>(pixel[i + 1]);
-			unsigned char red = static_cast<unsigned char>(pixel[i + 2]);
+		std::vector<size_t> channels(bgr_histogram_size);
+		bgr_histogram(raw_data + offset, characters.size() - offset, channels.data());
 
-			blue_histogram[blue]++;
-			green_histogram[green]++;
-			red_histogram[red]++;
-		}
+		std::vector<size_t> blue_histogram(channels.begin(), channels.begin() + 256);
+		std::vector<size_t> green_histogram(channels.begin() + 256, channels.begin() + 512);
+		std::vector<size_t> red_histogram(channels.begin() + 512, channels.end());
 
 		auto blue = std::make_tuple(std::move(blue_histogram), RGB::B);
 		auto green = std::make_tuple(std::move(green_histogram), RGB::G);
@@ -97,7 +91,7 @@ public:
 	}
 };
 
-class BitmapDecomposerRaw : public AlgorithmInterface<std::tuple<char*, unsigned long long>, std::map<int, size_t>> {
+class BitmapDecomposerRaw : public AlgorithmInterface<std::tuple<const char*, unsigned long long>, std::map<int, size_t>> {
 public:
 	BitmapDecomposerRaw() = default;
 
@@ -109,26 +103,12 @@ public:
 
 	virtual ~BitmapDecomposerRaw() = default;
 
-	std::map<int, size_t> Compute(std::tuple<char*, unsigned long long>&& input) const override {
+	std::map<int, size_t> Compute(std::tuple<const char*, unsigned long long>&& input) const override {
 		auto raw_data = std::get<0>(input);
 		auto size = std::get<1>(input);
 
-		std::vector<size_t> vector(768);
-		using st = std::vector<size_t>::size_type;
-
-		for (auto i = 0; i < size; i += 3) {
-			unsigned char b = raw_data[i];
-			unsigned char g = raw_data[i + 1];
-			unsigned char r = raw_data[i + 2];
-
-			const auto b_idx = static_cast<st>(b);
-			const auto g_idx = static_cast<st>(g) + 256;
-			const auto r_idx = static_cast<st>(r) + 512;
-
-			vector[b_idx] += 1;
-			vector[g_idx] += 1;
-			vector[r_idx] += 1;
-		}
+		std::vector<size_t> vector(bgr_histogram_size);
+		bgr_histogram(raw_data, size, vector.data());
 
 		std::map<int, size_t> result;
 
@@ -144,7 +124,7 @@ public:
 	}
 };
 
-class BitmapDecomposerRawVector : public AlgorithmInterface<std::tuple<char*, unsigned long long>, std::map<int, std::vector<size_t>>> {
+class BitmapDecomposerRawVector : public AlgorithmInterface<std::tuple<const char*, unsigned long long>, std::map<int, std::vector<size_t>>> {
 public:
 	BitmapDecomposerRawVector() = default;
 
@@ -156,26 +136,12 @@ public:
 
 	virtual ~BitmapDecomposerRawVector() = default;
 
-	std::map<int, std::vector<size_t>> Compute(std::tuple<char*, unsigned long long>&& input) const override {		
+	std::map<int, std::vector<size_t>> Compute(std::tuple<const char*, unsigned long long>&& input) const override {		
 		auto raw_data = std::get<0>(input);
 		auto size = std::get<1>(input);
 
-		std::vector<size_t> vector(768);
-		using st = std::vector<size_t>::size_type;
-
-		for (auto i = 0; i < size; i += 3) {
-			unsigned char b = raw_data[i];
-			unsigned char g = raw_data[i + 1];
-			unsigned char r = raw_data[i + 2];
-
-			const auto b_idx = static_cast<st>(b);
-			const auto g_idx = static_cast<st>(g) + 256;
-			const auto r_idx = static_cast<st>(r) + 512;
-
-			vector[b_idx]++;
-			vector[g_idx]++;
-			vector[r_idx]++;
-		}
+		std::vector<size_t> vector(bgr_histogram_size);
+		bgr_histogram(raw_data, size, vector.data());
 
 		std::map<int, std::vector<size_t>> result;
 
@@ -0,0 +1,258 @@
+#pragma once
+
+#include "../interfaces/AlgorithmInterface.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+// std::hash is the identity for integers, the finalizer of splitmix64 spreads strided keys
+// over all ranks.
+template<typename T_key>
+uint64_t partition_hash(const T_key& key) {
+	uint64_t hash = static_cast<uint64_t>(std::hash<T_key>{}(key));
+
+	hash = (hash ^ (hash >> 30)) * 0xbf58476d1ce4e5b9ull;
+	hash = (hash ^ (hash >> 27)) * 0x94d049bb133111ebull;
+	return hash ^ (hash >> 31);
+}
+
+// A distributer for MapReduceGlobalH that assigns the ranks of all keys of a shuffle in one
+// call. Partitioners that use a histogram receive the number of values per key of every run,
+// summed over all ranks, after the keys of that run have been assigned.
+template<typename T_key>
+class Partitioner : public AlgorithmInterface<T_key, int> {
+protected:
+	int nodes{};
+
+public:
+	explicit Partitioner(int nodes) : nodes(nodes) {
+		assert(nodes > 0 && "A partitioner needs at least one node");
+	}
+
+	Partitioner(const Partitioner& other) = default;
+	Partitioner(Partitioner&& other) = default;
+
+	Partitioner& operator=(const Partitioner& other) = default;
+	Partitioner& operator=(Partitioner&& other) = default;
+
+	virtual ~Partitioner() = default;
+
+	// The keys arrive in ascending order.
+	virtual void ComputeBatch(const std::vector<T_key>& keys, std::vector<int>& ranks) const {
+		ranks.resize(keys.size());
+
+		for (size_t i = 0; i < keys.size(); i++) {
+			ranks[i] = this->Compute(T_key(keys[i]));
+		}
+	}
+
+	// The number of ranks the keys are assigned to.
+	int Nodes() const noexcept {
+		return nodes;
+	}
+
+	virtual bool UsesHistogram() const {
+		return false;
+	}
+
+	virtual void Observe(const std::map<T_key, size_t>& /* histogram */) { }
+};
+
+template<typename T_key>
+class HashPartitioner : public Partitioner<T_key> {
+public:
+	explicit HashPartitioner(int nodes) : Partitioner<T_key>(nodes) { }
+
+	int Compute(T_key&& key) const override {
+		return static_cast<int>(partition_hash(key) % static_cast<uint64_t>(this->nodes));
+	}
+
+	void ComputeBatch(const std::vector<T_key>& keys, std::vector<int>& ranks) const override {
+		ranks.resize(keys.size());
+
+		for (size_t i = 0; i < keys.size(); i++) {
+			ranks[i] = static_cast<int>(partition_hash(keys[i]) % static_cast<uint64_t>(this->nodes));
+		}
+	}
+
+	std::string Name() const override {
+		return std::string("hash_partitioner");
+	}
+};
+
+// Rank i receives the keys in [splits[i - 1], splits[i]), which keeps neighbouring keys on
+// the same rank. The keys of a batch are sorted, so the batch walks the splits once.
+template<typename T_key>
+class RangePartitioner : public Partitioner<T_key> {
+	std::vector<T_key> splits{};
+
+public:
+	explicit RangePartitioner(std::vector<T_key> splits) : Partitioner<T_key>(static_cast<int>(splits.size()) + 1), splits(std::move(splits)) {
+		assert(std::is_sorted(this->splits.begin(), this->splits.end()) && "The splits have to be sorted");
+	}
+
+	int Compute(T_key&& key) const override {
+		return static_cast<int>(std::upper_bound(splits.begin(), splits.end(), key) - splits.begin());
+	}
+
+	void ComputeBatch(const std::vector<T_key>& keys, std::vector<int>& ranks) const override {
+		assert(std::is_sorted(keys.begin(), keys.end()) && "The keys of a batch have to be sorted");
+
+		ranks.resize(keys.size());
+
+		size_t node = 0;
+
+		for (size_t i = 0; i < keys.size(); i++) {
+			while (node < splits.size() && !(keys[i] < splits[node])) {
+				node++;
+			}
+
+			ranks[i] = static_cast<int>(node);
+		}
+	}
+
+	std::string Name() const override {
+		return std::string("range_partitioner");
+	}
+};
+
+// Places virtual_nodes points per rank on a hash ring, a key belongs to the rank of the next
+// point. A ring for a different rank count keeps most points, so only the keys next to the
+// points that were added or removed move to another rank.
+template<typename T_key>
+class ConsistentHashPartitioner : public Partitioner<T_key> {
+	std::vector<std::pair<uint64_t, int>> ring{};
+
+	int Lookup(uint64_t hash) const {
+		auto point = std::lower_bound(ring.begin(), ring.end(), std::make_pair(hash, 0));
+
+		if (point == ring.end()) {
+			point = ring.begin();
+		}
+
+		return point->second;
+	}
+
+public:
+	ConsistentHashPartitioner(int nodes, size_t virtual_nodes = 64) : Partitioner<T_key>(nodes) {
+		assert(virtual_nodes > 0 && "Every node needs a point on the ring");
+
+		ring.reserve(static_cast<size_t>(nodes) * virtual_nodes);
+
+		for (auto node = 0; node < nodes; node++) {
+			for (size_t i = 0; i < virtual_nodes; i++) {
+				ring.emplace_back(partition_hash((static_cast<uint64_t>(node) << 32) | i), node);
+			}
+		}
+
+		std::sort(ring.begin(), ring.end());
+	}
+
+	int Compute(T_key&& key) const override {
+		return Lookup(partition_hash(key));
+	}
+
+	void ComputeBatch(const std::vector<T_key>& keys, std::vector<int>& ranks) const override {
+		ranks.resize(keys.size());
+
+		for (size_t i = 0; i < keys.size(); i++) {
+			ranks[i] = Lookup(partition_hash(keys[i]));
+		}
+	}
+
+	std::string Name() const override {
+		return std::string("consistent_hash_partitioner");
+	}
+};
+
+// Assigns the keys of the previous run greedily, the key with the most values first to the
+// rank with the fewest values so far. Keys that did not occur in the previous run are hashed.
+// The histogram is the same on every rank and ties are broken by key and rank, so all ranks
+// build the same assignment.
+template<typename T_key>
+class LoadBalancedPartitioner : public Partitioner<T_key> {
+	mutable std::mutex mutex{};
+	std::map<T_key, int> assignment{};
+
+	int Lookup(const T_key& key) const {
+		auto entry = assignment.find(key);
+
+		if (entry == assignment.end()) {
+			return static_cast<int>(partition_hash(key) % static_cast<uint64_t>(this->nodes));
+		}
+
+		return entry->second;
+	}
+
+public:
+	explicit LoadBalancedPartitioner(int nodes) : Partitioner<T_key>(nodes) { }
+
+	LoadBalancedPartitioner(const LoadBalancedPartitioner& other) = delete;
+	LoadBalancedPartitioner(LoadBalancedPartitioner&& other) = delete;
+
+	LoadBalancedPartitioner& operator=(const LoadBalancedPartitioner& other) = delete;
+	LoadBalancedPartitioner& operator=(LoadBalancedPartitioner&& other) = delete;
+
+	int Compute(T_key&& key) const override {
+		std::lock_guard<std::mutex> lock(mutex);
+		return Lookup(key);
+	}
+
+	void ComputeBatch(const std::vector<T_key>& keys, std::vector<int>& ranks) const override {
+		std::lock_guard<std::mutex> lock(mutex);
+
+		ranks.resize(keys.size());
+
+		for (size_t i = 0; i < keys.size(); i++) {
+			ranks[i] = Lookup(keys[i]);
+		}
+	}
+
+	bool UsesHistogram() const override {
+		return true;
+	}
+
+	void Observe(const std::map<T_key, size_t>& histogram) override {
+		std::vector<std::pair<size_t, const T_key*>> counts{};
+		counts.reserve(histogram.size());
+
+		for (auto& [key, count] : histogram) {
+			counts.emplace_back(count, &key);
+		}
+
+		std::stable_sort(counts.begin(), counts.end(), [](const auto& first, const auto& second) { return first.first > second.first; });
+
+		typedef std::pair<size_t, int> load;
+		std::priority_queue<load, std::vector<load>, std::greater<load>> loads{};
+
+		for (auto node = 0; node < this->nodes; node++) {
+			loads.emplace(0, node);
+		}
+
+		std::map<T_key, int> next_assignment{};
+
+		for (auto& [count, key] : counts) {
+			auto [node_load, node] = loads.top();
+			loads.pop();
+
+			next_assignment.emplace(*key, node);
+			loads.emplace(node_load + count, node);
+		}
+
+		std::lock_guard<std::mutex> lock(mutex);
+		assignment.swap(next_assignment);
+	}
+
+	std::string Name() const override {
+		return std::string("load_balanced_partitioner");
+	}
+};
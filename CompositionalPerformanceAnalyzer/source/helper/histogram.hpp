@@ -0,0 +1,71 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+// Histogram of 24-bit BGR pixels: blue counts at [0, 256), green at [256, 512) and red at
+// [512, 768).
+constexpr const size_t bgr_histogram_size = 768;
+
+// Neighbouring pixels go to different sub-histograms, so runs of the same color do not wait
+// on the increment of the previous pixel. The 32-bit counters keep all of them in L1 and are
+// added to the result after every block.
+constexpr const size_t bgr_sub_histogram_count = 4;
+constexpr const size_t bgr_block_pixels = size_t(1) << 28;
+
+typedef std::array<std::array<uint32_t, bgr_histogram_size>, bgr_sub_histogram_count> bgr_sub_histograms;
+
+inline void bgr_histogram_flush(bgr_sub_histograms& sub_histograms, size_t* histogram) {
+	for (auto& sub_histogram : sub_histograms) {
+		for (size_t i = 0; i < bgr_histogram_size; i++) {
+			histogram[i] += sub_histogram[i];
+		}
+
+		sub_histogram.fill(0);
+	}
+}
+
+inline void bgr_histogram_block(const unsigned char* pixel, size_t pixels, bgr_sub_histograms& sub_histograms) {
+	size_t i = 0;
+
+	for (; i + bgr_sub_histogram_count <= pixels; i += bgr_sub_histogram_count) {
+		for (size_t lane = 0; lane < bgr_sub_histogram_count; lane++) {
+			const auto* bgr = pixel + 3 * (i + lane);
+			auto& sub_histogram = sub_histograms[lane];
+
+			sub_histogram[bgr[0]]++;
+			sub_histogram[bgr[1] + 256]++;
+			sub_histogram[bgr[2] + 512]++;
+		}
+	}
+
+	for (; i < pixels; i++) {
+		const auto* bgr = pixel + 3 * i;
+
+		sub_histograms[0][bgr[0]]++;
+		sub_histograms[0][bgr[1] + 256]++;
+		sub_histograms[0][bgr[2] + 512]++;
+	}
+}
+
+
+// Adds the counts of size bytes of BGR pixels to histogram, which has bgr_histogram_size
+// entries. The bytes of a trailing incomplete pixel count for the channels they hold.
+inline void bgr_histogram(const char* data, size_t size, size_t* histogram) {
+	const auto* pixel = reinterpret_cast<const unsigned char*>(data);
+	const auto pixels = size / 3;
+
+	bgr_sub_histograms sub_histograms{};
+
+	for (size_t first = 0; first < pixels; first += bgr_block_pixels) {
+		auto block = pixels - first < bgr_block_pixels ? pixels - first : bgr_block_pixels;
+
+		bgr_histogram_block(pixel + 3 * first, block, sub_histograms);
+		bgr_histogram_flush(sub_histograms, histogram);
+	}
+
+	for (size_t i = 3 * pixels; i < size; i++) {
+		histogram[pixel[i] + 256 * (i - 3 * pixels)]++;
+	}
+}
@@ -1,6 +1,15 @@
 #pragma once
 
 #include <mpi.h>
+
+#include <cassert>
+#include <climits>
+#include <cstring>
+#include <map>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
 int mpi_sync_global(MPI_Comm comm) {
@@ -22,19 +31,82 @@ int mpi_get_global_rank() {
 	return val;
 }
 
+inline int mpi_get_global_size() {
+	int val;
+	MPI_Comm_size(MPI_COMM_WORLD, &val);
+	return val;
+}
+
+// The MPI datatype of a trivially copyable type. Arithmetic types map to the predefined
+// datatypes, everything else to a contiguous run of bytes that is committed once.
+template<typename T>
+MPI_Datatype mpi_datatype() {
+	static_assert(std::is_trivially_copyable_v<T>, "Only trivially copyable types have an MPI datatype, use mpi_send_object");
+
+	if constexpr (std::is_same_v<T, char>) {
+		return MPI_CHAR;
+	}
+	else if constexpr (std::is_same_v<T, signed char>) {
+		return MPI_SIGNED_CHAR;
+	}
+	else if constexpr (std::is_same_v<T, unsigned char>) {
+		return MPI_UNSIGNED_CHAR;
+	}
+	else if constexpr (std::is_same_v<T, short>) {
+		return MPI_SHORT;
+	}
+	else if constexpr (std::is_same_v<T, unsigned short>) {
+		return MPI_UNSIGNED_SHORT;
+	}
+	else if constexpr (std::is_same_v<T, int>) {
+		return MPI_INT;
+	}
+	else if constexpr (std::is_same_v<T, unsigned int>) {
+		return MPI_UNSIGNED;
+	}
+	else if constexpr (std::is_same_v<T, long>) {
+		return MPI_LONG;
+	}
+	else if constexpr (std::is_same_v<T, unsigned long>) {
+		return MPI_UNSIGNED_LONG;
+	}
+	else if constexpr (std::is_same_v<T, long long>) {
+		return MPI_LONG_LONG;
+	}
+	else if constexpr (std::is_same_v<T, unsigned long long>) {
+		return MPI_UNSIGNED_LONG_LONG;
+	}
+	else if constexpr (std::is_same_v<T, float>) {
+		return MPI_FLOAT;
+	}
+	else if constexpr (std::is_same_v<T, double>) {
+		return MPI_DOUBLE;
+	}
+	else {
+		static MPI_Datatype type = []() {
+			MPI_Datatype contiguous;
+			MPI_Type_contiguous(static_cast<int>(sizeof(T)), MPI_BYTE, &contiguous);
+			MPI_Type_commit(&contiguous);
+			return contiguous;
+		}();
+
+		return type;
+	}
+}
+
 template<typename T, int tag = 0>
-int mpi_send_global(T* data, int count, int dest) {
-	return MPI_Send(data, sizeof(T) * count, MPI_BYTE, dest, tag, MPI_COMM_WORLD);
+int mpi_send_global(const T* data, int count, int dest) {
+	return MPI_Send(data, count, mpi_datatype<T>(), dest, tag, MPI_COMM_WORLD);
 }
 
 template<typename T, int tag = 0>
-int mpi_send_global(std::vector<T>& vec, int dest) {
-	return mpi_send_global(vec.data(), vec.size(), dest);
+int mpi_send_global(const std::vector<T>& vec, int dest) {
+	return mpi_send_global<T, tag>(vec.data(), static_cast<int>(vec.size()), dest);
 }
 
 template<typename T, int tag = 0>
 int mpi_receive_global(T* data, int count, int src) {
-	return MPI_Recv(data, sizeof(T) * count, MPI_BYTE, src, tag, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+	return MPI_Recv(data, count, mpi_datatype<T>(), src, tag, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
 }
 
 template<typename T, int tag = 0>
@@ -44,13 +116,346 @@ int mpi_receive_global(T* data, size_t count, int src) {
 
 template<int tag = 0>
 void mpi_send_size(int dst, size_t size) {
-	mpi_send_global(&size, 1, dst);
+	mpi_send_global<size_t, tag>(&size, 1, dst);
 }
 
 template<int tag = 0>
 size_t mpi_receive_size(int src) {
 	size_t size;
-	mpi_receive_global(&size, 1, src);
+	mpi_receive_global<size_t, tag>(&size, 1, src);
 	return size;
 }
 
+template<typename T, int tag = 0>
+int mpi_isend_global(const T* data, int count, int dest, MPI_Request* request) {
+	return MPI_Isend(data, count, mpi_datatype<T>(), dest, tag, MPI_COMM_WORLD, request);
+}
+
+template<typename T, int tag = 0>
+int mpi_ireceive_global(T* data, int count, int src, MPI_Request* request) {
+	return MPI_Irecv(data, count, mpi_datatype<T>(), src, tag, MPI_COMM_WORLD, request);
+}
+
+// Returns true and the index of the request if one of the active requests has completed.
+inline bool mpi_test_any(std::vector<MPI_Request>& requests, int* index) {
+	int flag = 0;
+	MPI_Testany(static_cast<int>(requests.size()), requests.data(), index, &flag, MPI_STATUS_IGNORE);
+	return flag != 0 && *index != MPI_UNDEFINED;
+}
+
+inline int mpi_wait_all(std::vector<MPI_Request>& requests) {
+	return MPI_Waitall(static_cast<int>(requests.size()), requests.data(), MPI_STATUSES_IGNORE);
+}
+
+// Sends count elements to every rank and receives count elements from every rank.
+template<typename T>
+int mpi_all_to_all_global(const T* send, T* receive, int count) {
+	return MPI_Alltoall(send, count, mpi_datatype<T>(), receive, count, mpi_datatype<T>(), MPI_COMM_WORLD);
+}
+
+// Describes how a value is laid out in a packed message. Trivially copyable types are
+// copied as they are, the specializations below write containers as their length followed
+// by their elements. Specialize it to send further types with mpi_send_object.
+template<typename T, typename Enable = void>
+struct mpi_serializer {
+	static_assert(std::is_trivially_copyable_v<T>, "Specialize mpi_serializer to send this type");
+
+	static size_t size(const T&) {
+		return sizeof(T);
+	}
+
+	static void write(char*& out, const T& value) {
+		std::memcpy(out, &value, sizeof(T));
+		out += sizeof(T);
+	}
+
+	static void read(const char*& in, T& value) {
+		std::memcpy(&value, in, sizeof(T));
+		in += sizeof(T);
+	}
+};
+
+// Shared by vector and string: the length, then the elements in one block if they are
+// trivially copyable and one by one otherwise.
+template<typename T_container, typename T_element>
+struct mpi_sequence_serializer {
+	static size_t size(const T_container& container) {
+		auto bytes = sizeof(size_t);
+
+		if constexpr (std::is_trivially_copyable_v<T_element>) {
+			bytes += sizeof(T_element) * container.size();
+		}
+		else {
+			for (auto& element : container) {
+				bytes += mpi_serializer<T_element>::size(element);
+			}
+		}
+
+		return bytes;
+	}
+
+	static void write(char*& out, const T_container& container) {
+		mpi_serializer<size_t>::write(out, container.size());
+
+		if constexpr (std::is_trivially_copyable_v<T_element>) {
+			auto bytes = sizeof(T_element) * container.size();
+
+			if (bytes > 0) {
+				std::memcpy(out, container.data(), bytes);
+				out += bytes;
+			}
+		}
+		else {
+			for (auto& element : container) {
+				mpi_serializer<T_element>::write(out, element);
+			}
+		}
+	}
+
+	static void read(const char*& in, T_container& container) {
+		size_t count{};
+		mpi_serializer<size_t>::read(in, count);
+
+		container.resize(count);
+
+		if constexpr (std::is_trivially_copyable_v<T_element>) {
+			auto bytes = sizeof(T_element) * count;
+
+			if (bytes > 0) {
+				std::memcpy(container.data(), in, bytes);
+				in += bytes;
+			}
+		}
+		else {
+			for (auto& element : container) {
+				mpi_serializer<T_element>::read(in, element);
+			}
+		}
+	}
+};
+
+template<typename T, typename T_allocator>
+struct mpi_serializer<std::vector<T, T_allocator>> : mpi_sequence_serializer<std::vector<T, T_allocator>, T> {
+	static_assert(!std::is_same_v<T, bool>, "std::vector<bool> is not contiguous");
+};
+
+template<typename T_char, typename T_traits, typename T_allocator>
+struct mpi_serializer<std::basic_string<T_char, T_traits, T_allocator>>
+	: mpi_sequence_serializer<std::basic_string<T_char, T_traits, T_allocator>, T_char> { };
+
+template<typename T_first, typename T_second>
+struct mpi_serializer<std::pair<T_first, T_second>> {
+	static size_t size(const std::pair<T_first, T_second>& pair) {
+		return mpi_serializer<T_first>::size(pair.first) + mpi_serializer<T_second>::size(pair.second);
+	}
+
+	static void write(char*& out, const std::pair<T_first, T_second>& pair) {
+		mpi_serializer<T_first>::write(out, pair.first);
+		mpi_serializer<T_second>::write(out, pair.second);
+	}
+
+	static void read(const char*& in, std::pair<T_first, T_second>& pair) {
+		mpi_serializer<T_first>::read(in, pair.first);
+		mpi_serializer<T_second>::read(in, pair.second);
+	}
+};
+
+template<typename... T_elements>
+struct mpi_serializer<std::tuple<T_elements...>> {
+	static size_t size(const std::tuple<T_elements...>& tuple) {
+		return std::apply([](const auto&... element) {
+			return (size_t(0) + ... + mpi_serializer<std::decay_t<decltype(element)>>::size(element));
+		}, tuple);
+	}
+
+	static void write(char*& out, const std::tuple<T_elements...>& tuple) {
+		std::apply([&out](const auto&... element) {
+			(mpi_serializer<std::decay_t<decltype(element)>>::write(out, element), ...);
+		}, tuple);
+	}
+
+	static void read(const char*& in, std::tuple<T_elements...>& tuple) {
+		std::apply([&in](auto&... element) {
+			(mpi_serializer<std::decay_t<decltype(element)>>::read(in, element), ...);
+		}, tuple);
+	}
+};
+
+template<typename T_key, typename T_value, typename T_compare, typename T_allocator>
+struct mpi_serializer<std::map<T_key, T_value, T_compare, T_allocator>> {
+	typedef std::map<T_key, T_value, T_compare, T_allocator> map_type;
+
+	static size_t size(const map_type& map) {
+		auto bytes = sizeof(size_t);
+
+		for (auto& [key, value] : map) {
+			bytes += mpi_serializer<T_key>::size(key) + mpi_serializer<T_value>::size(value);
+		}
+
+		return bytes;
+	}
+
+	static void write(char*& out, const map_type& map) {
+		mpi_serializer<size_t>::write(out, map.size());
+
+		for (auto& [key, value] : map) {
+			mpi_serializer<T_key>::write(out, key);
+			mpi_serializer<T_value>::write(out, value);
+		}
+	}
+
+	static void read(const char*& in, map_type& map) {
+		size_t count{};
+		mpi_serializer<size_t>::read(in, count);
+
+		for (size_t i = 0; i < count; i++) {
+			T_key key{};
+			T_value value{};
+
+			mpi_serializer<T_key>::read(in, key);
+			mpi_serializer<T_value>::read(in, value);
+
+			map.emplace_hint(map.end(), std::move(key), std::move(value));
+		}
+	}
+};
+
+// Appends the packed value to buffer, which grows once by the exact size.
+template<typename T>
+void mpi_pack(const T& value, std::vector<char>& buffer) {
+	auto offset = buffer.size();
+	buffer.resize(offset + mpi_serializer<T>::size(value));
+
+	auto* out = buffer.data() + offset;
+	mpi_serializer<T>::write(out, value);
+}
+
+template<typename T>
+void mpi_unpack(const char*& in, T& value) {
+	mpi_serializer<T>::read(in, value);
+}
+
+// Sends any serializable value as one message.
+template<typename T, int tag = 0>
+int mpi_send_object(const T& value, int dest) {
+	std::vector<char> buffer{};
+	mpi_pack(value, buffer);
+
+	assert(buffer.size() <= static_cast<size_t>(INT_MAX) && "The message is too large");
+
+	return mpi_send_global<char, tag>(buffer.data(), static_cast<int>(buffer.size()), dest);
+}
+
+// Receives a packed message without unpacking it, so the unpacking can move to another thread.
+template<int tag = 0>
+std::vector<char> mpi_receive_packed(int src) {
+	MPI_Status status;
+	MPI_Probe(src, tag, MPI_COMM_WORLD, &status);
+
+	int bytes = 0;
+	MPI_Get_count(&status, MPI_CHAR, &bytes);
+
+	std::vector<char> buffer(bytes);
+	mpi_receive_global<char, tag>(buffer.data(), bytes, src);
+
+	return buffer;
+}
+
+template<typename T>
+T mpi_unpack_object(const std::vector<char>& buffer) {
+	T value{};
+
+	const char* in = buffer.data();
+	mpi_unpack(in, value);
+
+	return value;
+}
+
+template<typename T, int tag = 0>
+T mpi_receive_object(int src) {
+	return mpi_unpack_object<T>(mpi_receive_packed<tag>(src));
+}
+
+// Replaces the value on every rank with the value of root.
+template<typename T>
+void mpi_broadcast_object(T& value, int root) {
+	const auto rank = mpi_get_global_rank();
+
+	std::vector<char> buffer{};
+
+	if (rank == root) {
+		mpi_pack(value, buffer);
+	}
+
+	size_t bytes = buffer.size();
+	MPI_Bcast(&bytes, 1, mpi_datatype<size_t>(), root, MPI_COMM_WORLD);
+
+	assert(bytes <= static_cast<size_t>(INT_MAX) && "The message is too large");
+
+	buffer.resize(bytes);
+	MPI_Bcast(buffer.data(), static_cast<int>(bytes), MPI_CHAR, root, MPI_COMM_WORLD);
+
+	if (rank != root) {
+		value = mpi_unpack_object<T>(buffer);
+	}
+}
+
+// Returns true if a message with the tag from src is ready to be received.
+template<int tag = 0>
+bool mpi_probe_global(int src) {
+	int flag = 0;
+	MPI_Iprobe(src, tag, MPI_COMM_WORLD, &flag, MPI_STATUS_IGNORE);
+	return flag != 0;
+}
+
+// Whether MPI may be called from several threads at once.
+inline bool mpi_thread_multiple() {
+	int provided = MPI_THREAD_SINGLE;
+	MPI_Query_thread(&provided);
+	return provided >= MPI_THREAD_MULTIPLE;
+}
+
+constexpr const int mpi_tree_tag = 4;
+
+// Binomial tree over the ranks [0, nodes): in round k every rank with bit k set hands its map
+// to the rank 2^k below it and drops out, so rank 0 holds the merged map after log2(nodes)
+// rounds and every other rank ends with an empty map.
+inline std::vector<int> mpi_tree_children(int rank, int nodes) {
+	std::vector<int> children{};
+
+	for (auto mask = 1; mask < nodes && (rank & mask) == 0; mask <<= 1) {
+		if (rank + mask < nodes) {
+			children.emplace_back(rank + mask);
+		}
+	}
+
+	return children;
+}
+
+// The rank that receives the map of rank in the tree, -1 for the root.
+inline int mpi_tree_parent(int rank) {
+	return rank == 0 ? -1 : rank - (rank & -rank);
+}
+
+// Merges the children in rank order on the calling thread. merge(mine, received) has to be
+// associative.
+template<typename T_key, typename T_value, typename Merge>
+void mpi_tree_reduce_map(std::map<T_key, T_value>& map, int nodes, Merge merge) {
+	const auto rank = mpi_get_global_rank();
+
+	if (rank >= nodes) {
+		return;
+	}
+
+	for (auto child : mpi_tree_children(rank, nodes)) {
+		auto received = mpi_receive_object<std::map<T_key, T_value>, mpi_tree_tag>(child);
+		merge(map, received);
+	}
+
+	auto parent = mpi_tree_parent(rank);
+
+	if (parent >= 0) {
+		mpi_send_object<std::map<T_key, T_value>, mpi_tree_tag>(map, parent);
+		map.clear();
+	}
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include "../Commons.hpp"
+
+#include <algorithm>
+#include <array>
+#include <climits>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+constexpr const size_t radix_sort_threshold = 64;
+
+// LSD radix sort of (key, value) pairs by an integral key, one byte per pass. A pass in
+// which all keys share the same byte is skipped, so narrow key ranges need few passes.
+template<typename T_key, typename T_value>
+void radix_sort_by_key(std::vector<std::pair<T_key, T_value>>& pairs) {
+	static_assert(std::is_integral_v<T_key> && !std::is_same_v<T_key, bool>, "Radix sort needs integral keys");
+
+	using T_unsigned = std::make_unsigned_t<T_key>;
+
+	// Flipping the sign bit orders negative keys before positive ones.
+	constexpr const T_unsigned sign_flip = std::is_signed_v<T_key> ? static_cast<T_unsigned>(T_unsigned(1) << (sizeof(T_key) * CHAR_BIT - 1)) : T_unsigned(0);
+
+	if (pairs.size() < 2) {
+		return;
+	}
+
+	std::vector<std::pair<T_key, T_value>> buffer(pairs.size());
+
+	auto* source = &pairs;
+	auto* target = &buffer;
+
+	for (size_t pass = 0; pass < sizeof(T_key); pass++) {
+		const auto shift = pass * CHAR_BIT;
+
+		auto digit = [shift](const T_key& key) {
+			return static_cast<size_t>((static_cast<T_unsigned>(static_cast<T_unsigned>(key) ^ sign_flip) >> shift) & 0xff);
+		};
+
+		std::array<size_t, 256> offsets{};
+
+		for (auto& pair : *source) {
+			offsets[digit(pair.first)]++;
+		}
+
+		if (offsets[digit(source->front().first)] == source->size()) {
+			continue;
+		}
+
+		auto position = 0ull;
+
+		for (auto& offset : offsets) {
+			auto count = offset;
+			offset = position;
+			position += count;
+		}
+
+		for (auto& pair : *source) {
+			(*target)[offsets[digit(pair.first)]++] = std::move(pair);
+		}
+
+		std::swap(source, target);
+	}
+
+	if (source != &pairs) {
+		pairs.swap(buffer);
+	}
+}
+
+// Radix sort for integral keys, std::sort on the keys for everything else and for short
+// vectors.
+template<typename T_key, typename T_value>
+void sort_by_key(std::vector<std::pair<T_key, T_value>>& pairs) {
+	if constexpr (std::is_integral_v<T_key> && !std::is_same_v<T_key, bool>) {
+		if (pairs.size() >= radix_sort_threshold) {
+			radix_sort_by_key(pairs);
+			return;
+		}
+	}
+
+	std::sort(pairs.begin(), pairs.end(), [](const auto& first, const auto& second) { return first.first < second.first; });
+}
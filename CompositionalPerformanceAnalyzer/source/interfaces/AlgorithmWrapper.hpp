@@ -2,8 +2,12 @@
 
 #include "../Commons.hpp"
 #include "AlgorithmInterface.hpp"
+#include "Future.hpp"
+#include "Task.hpp"
 #include "PatternInterface.hpp"
+#include "Scheduler.hpp"
 
+#include <exception>
 #include <future>
 #include <memory>
 
@@ -12,15 +16,35 @@ class AlgorithmWrapper : public PatternInterface<T_input, T_output> {
 	AlgoIntPtr<T_input, T_output> interface;
 
 	void InternallyCompute(std::future<T_input> future, std::promise<T_output> promise) override {
-		auto input = future.get();
-		auto result = interface->Compute(std::move(input));
-		promise.set_value(std::move(result));
+		try {
+			auto input = await_future(future);
+			auto result = interface->Compute(std::move(input));
+			promise.set_value(std::move(result));
+		}
+		catch (...) {
+			promise.set_exception(std::current_exception());
+		}
 	}
 
 	T_output InternallyComputePure(T_input&& input) override {
 		return interface->Compute(std::move(input));
 	}
 
+	Future<T_output> InternallyComputeAsync(Future<T_input> input) override {
+		auto algorithm = interface;
+
+		return input.Then([algorithm](T_input&& value) {
+			return algorithm->Compute(std::move(value));
+		});
+	}
+
+#if defined(CPA_COROUTINES)
+	Task<T_output> InternallyComputeTask(T_input input) override {
+		co_await ScheduleOnWorker{};
+		co_return interface->Compute(std::move(input));
+	}
+#endif
+
 	explicit AlgorithmWrapper(AlgoIntPtr<T_input, T_output> i) : interface(i) {}
 
 public:
@@ -0,0 +1,232 @@
+#pragma once
+
+#include "../Commons.hpp"
+#include "Executor.hpp"
+#include "Future.hpp"
+#include "ThreadSafeQueue.hpp"
+
+#include <atomic>
+#include <exception>
+#include <tuple>
+#include <vector>
+
+// The input queue of a TaskPool or a pipeline stage. An input is queued as a value together
+// with the Promise of its output once it has arrived, so a worker never waits for an input.
+// Single inputs and batches count against one high-water mark, a batch takes one slot.
+// Compute() reserves a slot before it pushes and blocks while there is none. ComputeAsync
+// pushes right away, an input that finds the queue full waits in an overflow queue instead
+// of blocking and is admitted as soon as a worker frees a slot.
+template<typename T_input, typename T_output>
+class AsyncQueue {
+	typedef std::tuple<T_input, Promise<T_output>> entry;
+	typedef std::tuple<std::vector<T_input>, Promise<std::vector<T_output>>> batch_entry;
+
+	std::atomic<size_t> occupied{};
+	size_t high_water_mark{};
+
+	TSQueue<entry> admitted{};
+	TSQueue<batch_entry> admitted_batches{};
+
+	TSQueue<entry> overflow{};
+	TSQueue<batch_entry> overflow_batches{};
+
+	std::atomic<size_t> waiting{};
+
+	// The slot of the input is already reserved, a failed input gives it back.
+	template<typename T_value, typename T_result, typename Notify>
+	Future<T_result> Enqueue(Future<T_value> input, TSQueue<std::tuple<T_value, Promise<T_result>>>& queue, Notify notify) {
+		Promise<T_result> promise{};
+		auto output = promise.GetFuture();
+
+		input.FinallyInline([&queue, promise, notify](T_value&& value) {
+			queue.push(std::make_tuple(std::move(value), promise));
+			notify();
+		}, [this, promise](std::exception_ptr error) mutable {
+			Release();
+			promise.SetException(error);
+		});
+
+		return output;
+	}
+
+	template<typename T_value, typename T_result, typename Notify>
+	Future<T_result> EnqueueOrWait(Future<T_value> input, TSQueue<std::tuple<T_value, Promise<T_result>>>& queue,
+		TSQueue<std::tuple<T_value, Promise<T_result>>>& overflow_queue, Notify notify) {
+		Promise<T_result> promise{};
+		auto output = promise.GetFuture();
+
+		input.FinallyInline([this, &queue, &overflow_queue, promise, notify](T_value&& value) {
+			if (TryReserve()) {
+				queue.push(std::make_tuple(std::move(value), promise));
+			}
+			else {
+				waiting.fetch_add(1);
+				overflow_queue.push(std::make_tuple(std::move(value), promise));
+
+				// The workers may have freed the slots between the reservation and the push.
+				Admit();
+			}
+
+			notify();
+		}, [promise](std::exception_ptr error) mutable {
+			promise.SetException(error);
+		});
+
+		return output;
+	}
+
+public:
+	explicit AsyncQueue(size_t high_water_mark = 0) : high_water_mark(high_water_mark) { }
+
+	AsyncQueue(const AsyncQueue& other) = delete;
+	AsyncQueue(AsyncQueue&& other) = delete;
+
+	AsyncQueue& operator=(const AsyncQueue& other) = delete;
+	AsyncQueue& operator=(AsyncQueue&& other) = delete;
+
+	// A high-water mark of 0 never runs out of slots.
+	bool TryReserve() {
+		auto previous = occupied.fetch_add(1);
+
+		if (high_water_mark == 0 || previous < high_water_mark) {
+			return true;
+		}
+
+		occupied.fetch_sub(1);
+		return false;
+	}
+
+	void Release() {
+		occupied.fetch_sub(1);
+	}
+
+	// For an input whose slot was reserved with TryReserve. It is queued once it has arrived
+	// and notify is called, so the pattern wakes a worker.
+	template<typename Notify>
+	Future<T_output> PushReserved(Future<T_input> input, Notify notify) {
+		return Enqueue(std::move(input), admitted, notify);
+	}
+
+	template<typename Notify>
+	Future<std::vector<T_output>> PushBatchReserved(Future<std::vector<T_input>> input, Notify notify) {
+		return Enqueue(std::move(input), admitted_batches, notify);
+	}
+
+	// Reserves the slot when the input arrives, or leaves the input waiting until there is one.
+	template<typename Notify>
+	Future<T_output> Push(Future<T_input> input, Notify notify) {
+		return EnqueueOrWait(std::move(input), admitted, overflow, notify);
+	}
+
+	template<typename Notify>
+	Future<std::vector<T_output>> PushBatch(Future<std::vector<T_input>> input, Notify notify) {
+		return EnqueueOrWait(std::move(input), admitted_batches, overflow_batches, notify);
+	}
+
+	// Moves waiting inputs into the admitted queues while there are free slots. Called by the
+	// workers of the pattern before they look for work.
+	void Admit() {
+		while (waiting.load() > 0 && TryReserve()) {
+			entry value{};
+
+			if (overflow.try_pop(value)) {
+				waiting.fetch_sub(1);
+				admitted.push(std::move(value));
+				continue;
+			}
+
+			batch_entry batch{};
+
+			if (overflow_batches.try_pop(batch)) {
+				waiting.fetch_sub(1);
+				admitted_batches.push(std::move(batch));
+				continue;
+			}
+
+			Release();
+			return;
+		}
+	}
+
+	// Blocking executors run the input in place, so the worker slot bounds them. Other
+	// executors hand it on to their own queues.
+	bool Perform(Executor<T_input, T_output>& executor) {
+		entry value{};
+
+		if (!admitted.try_pop(value)) {
+			return false;
+		}
+
+		Release();
+
+		auto input = std::move(std::get<0>(value));
+		auto promise = std::move(std::get<1>(value));
+
+		if (executor.IsBlocking()) {
+			try {
+				promise.SetValue(executor.Compute(std::move(input)));
+			}
+			catch (...) {
+				promise.SetException(std::current_exception());
+			}
+
+			return true;
+		}
+
+		forward_to_promise(executor.ComputeAsync(make_ready_future(std::move(input))), std::move(promise));
+
+		return true;
+	}
+
+	bool PopBatch(std::vector<T_input>& inputs, Promise<std::vector<T_output>>& promise) {
+		batch_entry batch{};
+
+		if (!admitted_batches.try_pop(batch)) {
+			return false;
+		}
+
+		Release();
+
+		inputs = std::move(std::get<0>(batch));
+		promise = std::move(std::get<1>(batch));
+
+		return true;
+	}
+
+	bool PerformBatch(Executor<T_input, T_output>& executor) {
+		std::vector<T_input> inputs{};
+		Promise<std::vector<T_output>> promise{};
+
+		if (!PopBatch(inputs, promise)) {
+			return false;
+		}
+
+		if (executor.IsBlocking()) {
+			try {
+				promise.SetValue(executor.ComputeBatch(std::move(inputs)));
+			}
+			catch (...) {
+				promise.SetException(std::current_exception());
+			}
+
+			return true;
+		}
+
+		forward_to_promise(executor.ComputeBatchAsync(make_ready_future(std::move(inputs))), std::move(promise));
+
+		return true;
+	}
+
+	// Inputs that hold a slot, whether they have arrived yet or not.
+	size_t Occupied() const noexcept {
+		return occupied.load();
+	}
+
+	size_t Waiting() const noexcept {
+		return waiting.load();
+	}
+
+	size_t Capacity() const noexcept {
+		return high_water_mark;
+	}
+};
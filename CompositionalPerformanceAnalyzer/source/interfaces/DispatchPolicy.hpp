@@ -0,0 +1,142 @@
+#pragma once
+
+#include "../Commons.hpp"
+
+#include <atomic>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <random>
+#include <string>
+
+class DispatchPolicy;
+
+using DispatchPolicyPtr = std::shared_ptr<DispatchPolicy>;
+
+// Picks the replica of an Executor that receives the next input. The load of a replica is
+// the number of inputs it has been handed but not finished (or not dequeued yet).
+class DispatchPolicy {
+public:
+	using LoadFunction = std::function<size_t(size_t)>;
+
+	DispatchPolicy() = default;
+
+	DispatchPolicy(const DispatchPolicy& other) = delete;
+	DispatchPolicy(DispatchPolicy&& other) = delete;
+
+	DispatchPolicy& operator=(const DispatchPolicy& other) = delete;
+	DispatchPolicy& operator=(DispatchPolicy&& other) = delete;
+
+	virtual ~DispatchPolicy() = default;
+
+	virtual size_t Select(size_t replica_count, const LoadFunction& load) = 0;
+
+	// Policies that never look at the load let the Executor skip the in-flight bookkeeping.
+	virtual bool NeedsLoad() const noexcept {
+		return true;
+	}
+
+	virtual DispatchPolicyPtr create_copy() const = 0;
+
+	virtual std::string Name() const = 0;
+};
+
+class RoundRobinDispatch : public DispatchPolicy {
+	std::atomic<unsigned long long int> round_robin_counter{};
+
+public:
+	static DispatchPolicyPtr create() {
+		return std::make_shared<RoundRobinDispatch>();
+	}
+
+	size_t Select(size_t replica_count, const LoadFunction&) override {
+		auto index = round_robin_counter.fetch_add(1, std::memory_order_relaxed);
+		return index % replica_count;
+	}
+
+	bool NeedsLoad() const noexcept override {
+		return false;
+	}
+
+	DispatchPolicyPtr create_copy() const override {
+		return create();
+	}
+
+	std::string Name() const override {
+		return std::string("round_robin");
+	}
+};
+
+class LeastOutstandingDispatch : public DispatchPolicy {
+public:
+	static DispatchPolicyPtr create() {
+		return std::make_shared<LeastOutstandingDispatch>();
+	}
+
+	size_t Select(size_t replica_count, const LoadFunction& load) override {
+		auto best_index = 0ull;
+		auto best_load = std::numeric_limits<size_t>::max();
+
+		for (auto i = 0ull; i < replica_count; i++) {
+			auto current_load = load(i);
+
+			if (current_load < best_load) {
+				best_index = i;
+				best_load = current_load;
+
+				if (current_load == 0) {
+					break;
+				}
+			}
+		}
+
+		return best_index;
+	}
+
+	DispatchPolicyPtr create_copy() const override {
+		return create();
+	}
+
+	std::string Name() const override {
+		return std::string("least_outstanding");
+	}
+};
+
+// Samples two replicas and takes the less loaded one, which gets close to the balance of
+// least-outstanding while only reading two counters per dispatch.
+class PowerOfTwoChoicesDispatch : public DispatchPolicy {
+	static std::minstd_rand& Generator() {
+		static thread_local std::minstd_rand generator(std::random_device{}());
+		return generator;
+	}
+
+public:
+	static DispatchPolicyPtr create() {
+		return std::make_shared<PowerOfTwoChoicesDispatch>();
+	}
+
+	size_t Select(size_t replica_count, const LoadFunction& load) override {
+		if (replica_count < 2) {
+			return 0;
+		}
+
+		auto& generator = Generator();
+
+		auto first = generator() % replica_count;
+		auto second = generator() % (replica_count - 1);
+
+		if (second >= first) {
+			second++;
+		}
+
+		return load(second) < load(first) ? second : first;
+	}
+
+	DispatchPolicyPtr create_copy() const override {
+		return create();
+	}
+
+	std::string Name() const override {
+		return std::string("power_of_two_choices");
+	}
+};
@@ -1,24 +1,79 @@
 #pragma once
 
+#include "DispatchPolicy.hpp"
+#include "Future.hpp"
 #include "PatternInterface.hpp"
+#include "Task.hpp"
 
 #include <atomic>
+#include <cassert>
+#include <exception>
+#include <memory>
 #include <vector>
 
 template<typename T_input, typename T_output>
 class Executor {
 	std::vector<PatIntPtr<T_input, T_output>> patterns{};
 
-	std::atomic<unsigned long long int> round_robin_counter{};
+	DispatchPolicyPtr policy{};
+	std::unique_ptr<std::atomic<size_t>[]> in_flight{};
+
 	bool holds_single{};
+	bool blocking{};
+	bool tracks_load{};
 	size_t size{};
 
+	size_t Load(size_t index) const {
+		return in_flight[index].load(std::memory_order_relaxed) + patterns[index]->Backlog();
+	}
+
+	size_t Select() {
+		if (holds_single) {
+			return 0;
+		}
+
+		return policy->Select(size, [this](size_t index) { return Load(index); });
+	}
+
+#if defined(CPA_COROUTINES)
+	static Task<T_output> TrackTask(Task<T_output> task, std::atomic<size_t>& counter) {
+		try {
+			auto result = co_await std::move(task);
+			counter.fetch_sub(1, std::memory_order_relaxed);
+			co_return result;
+		}
+		catch (...) {
+			counter.fetch_sub(1, std::memory_order_relaxed);
+			throw;
+		}
+	}
+#endif
+
+	// Counts the replica down once the output is set, whether it holds a value or an exception.
+	template<typename T>
+	static Future<T> Track(Future<T> output, std::atomic<size_t>* counter) {
+		Promise<T> promise{};
+		auto result = promise.GetFuture();
+
+		output.FinallyInline([counter, promise](T&& value) mutable {
+			counter->fetch_sub(1, std::memory_order_relaxed);
+			promise.SetValue(std::move(value));
+		}, [counter, promise](std::exception_ptr error) mutable {
+			counter->fetch_sub(1, std::memory_order_relaxed);
+			promise.SetException(error);
+		});
+
+		return result;
+	}
+
 public:
-	Executor(PatIntPtr<T_input, T_output> pattern, size_t count = 1) : round_robin_counter(0) {
+	Executor(PatIntPtr<T_input, T_output> pattern, size_t count = 1, DispatchPolicyPtr dispatch_policy = DispatchPolicyPtr())
+		: policy(dispatch_policy ? dispatch_policy : RoundRobinDispatch::create()) {
 		assert(count > 0 && "Have to repeat the pattern");
 
 		auto pattern_is_blocking = pattern->IsBlocking();
 		holds_single = count == 1 || pattern_is_blocking;
+		blocking = pattern_is_blocking;
 
 		if (holds_single) {
 			patterns = { pattern->create_copy() };
@@ -32,6 +87,9 @@ public:
 		}
 
 		size = count;
+
+		tracks_load = policy->NeedsLoad();
+		in_flight = std::make_unique<std::atomic<size_t>[]>(count);
 	}
 
 	Executor(const Executor&) = delete;
@@ -40,40 +98,165 @@ public:
 	Executor(Executor&&) = default;
 	Executor& operator=(Executor&&) = default;
 
+	// A std::promise has no hook back into the Executor, so with a load-aware policy the input
+	// takes the ComputeAsync path of the replica and its continuation fulfils the promise and
+	// counts the replica down again.
 	void Compute(std::future<T_input> future, std::promise<T_output> promise) {
-		auto mod_index = 0ull;
+		auto mod_index = Select();
+		auto& pattern = patterns[mod_index];
+
+		if (blocking) {
+			try {
+				auto input = await_future(future);
+				promise.set_value(pattern->InternallyComputePure(std::move(input)));
+			}
+			catch (...) {
+				promise.set_exception(std::current_exception());
+			}
 
-		if (!holds_single) {
-			auto index = round_robin_counter.fetch_add(1, std::memory_order::memory_order_relaxed);
-			mod_index = index % size;
+			return;
 		}
 
+		if (!tracks_load) {
+			pattern->InternallyCompute(std::move(future), std::move(promise));
+			return;
+		}
+
+		auto counter = &in_flight[mod_index];
+		counter->fetch_add(1, std::memory_order_relaxed);
+
+		forward_to_promise(Track(pattern->ComputeAsync(to_future(std::move(future))), counter), std::move(promise));
+	}
+
+	// Counted like Compute(), a batch holds its replica once until all of its outputs are set.
+	void ComputeBatch(std::future<std::vector<T_input>> future, std::promise<std::vector<T_output>> promise) {
+		auto mod_index = Select();
 		auto& pattern = patterns[mod_index];
-		pattern->InternallyCompute(std::move(future), std::move(promise));
+
+		if (!tracks_load) {
+			pattern->InternallyComputeBatch(std::move(future), std::move(promise));
+			return;
+		}
+
+		auto counter = &in_flight[mod_index];
+		counter->fetch_add(1, std::memory_order_relaxed);
+
+		forward_to_promise(Track(pattern->ComputeBatchAsync(to_future(std::move(future))), counter), std::move(promise));
 	}
 
-	std::future<T_output> Compute(std::future<T_input> future) {
-		auto mod_index = 0ull;
+	// Runs the batch in the calling thread, which is how blocking patterns are called.
+	std::vector<T_output> ComputeBatch(std::vector<T_input>&& inputs) {
+		auto& pattern = patterns[Select()];
 
-		if (!holds_single) {
-			auto index = round_robin_counter.fetch_add(1, std::memory_order::memory_order_relaxed);
-			mod_index = index % size;
+		std::vector<T_output> outputs{};
+		outputs.reserve(inputs.size());
+
+		for (auto& input : inputs) {
+			outputs.emplace_back(pattern->InternallyComputePure(std::move(input)));
 		}
 
+		return outputs;
+	}
+
+	Future<std::vector<T_output>> ComputeBatchAsync(Future<std::vector<T_input>> input) {
+		auto mod_index = Select();
 		auto& pattern = patterns[mod_index];
-		return pattern->Compute(std::move(future));
+
+		if (!tracks_load) {
+			return pattern->InternallyComputeBatchAsync(std::move(input));
+		}
+
+		auto counter = &in_flight[mod_index];
+		counter->fetch_add(1, std::memory_order_relaxed);
+
+		return Track(pattern->InternallyComputeBatchAsync(std::move(input)), counter);
+	}
+
+	std::future<T_output> Compute(std::future<T_input> future) {
+		auto mod_index = Select();
+		auto& pattern = patterns[mod_index];
+
+		if (!tracks_load) {
+			return pattern->Compute(std::move(future));
+		}
+
+		auto counter = &in_flight[mod_index];
+		counter->fetch_add(1, std::memory_order_relaxed);
+
+		std::promise<T_output> promise{};
+		auto output = promise.get_future();
+
+		forward_to_promise(Track(pattern->ComputeAsync(to_future(std::move(future))), counter), std::move(promise));
+
+		return output;
 	}
 
 	T_output Compute(T_input&& input) {
-		auto mod_index = 0ull;
+		auto mod_index = Select();
+		auto& pattern = patterns[mod_index];
 
-		if (!holds_single) {
-			auto index = round_robin_counter.fetch_add(1);
-			mod_index = index % size;
+		if (!tracks_load) {
+			return pattern->InternallyComputePure(std::move(input));
 		}
 
+		in_flight[mod_index].fetch_add(1, std::memory_order_relaxed);
+
+		try {
+			auto result = pattern->InternallyComputePure(std::move(input));
+			in_flight[mod_index].fetch_sub(1, std::memory_order_relaxed);
+
+			return result;
+		}
+		catch (...) {
+			in_flight[mod_index].fetch_sub(1, std::memory_order_relaxed);
+			throw;
+		}
+	}
+
+	Future<T_output> ComputeAsync(Future<T_input> input) {
+		auto mod_index = Select();
 		auto& pattern = patterns[mod_index];
-		return pattern->InternallyComputePure(std::move(input));
+
+		if (!tracks_load) {
+			return pattern->ComputeAsync(std::move(input));
+		}
+
+		auto counter = &in_flight[mod_index];
+		counter->fetch_add(1, std::memory_order_relaxed);
+
+		return Track(pattern->ComputeAsync(std::move(input)), counter);
+	}
+
+#if defined(CPA_COROUTINES)
+	Task<T_output> ComputeTask(T_input input) {
+		auto mod_index = Select();
+		auto& pattern = patterns[mod_index];
+
+		if (!tracks_load) {
+			return pattern->ComputeTask(std::move(input));
+		}
+
+		in_flight[mod_index].fetch_add(1, std::memory_order_relaxed);
+		return TrackTask(pattern->ComputeTask(std::move(input)), in_flight[mod_index]);
+	}
+#endif
+
+	size_t Backlog() const {
+		auto backlog = 0ull;
+
+		for (auto i = 0ull; i < patterns.size(); i++) {
+			backlog += patterns[i]->Backlog();
+		}
+
+		return backlog;
+	}
+
+	bool IsBlocking() const noexcept {
+		return blocking;
+	}
+
+	DispatchPolicyPtr GetPolicy() const {
+		return policy;
 	}
 
 	PatIntPtr<T_input, T_output> GetTask(size_t index = 0) {
@@ -0,0 +1,425 @@
+#pragma once
+
+#include "../Commons.hpp"
+#include "Scheduler.hpp"
+
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <type_traits>
+#include <vector>
+
+// Recycles fixed-size blocks per thread so that the shared state of a hop between two
+// stages does not cost a trip through the global heap.
+template<typename T>
+class PoolAllocator {
+	static constexpr const size_t max_cached = 1024;
+
+	struct BlockCache {
+		std::vector<void*> blocks{};
+
+		~BlockCache() {
+			for (auto block : blocks) {
+				::operator delete(block);
+			}
+		}
+	};
+
+	static BlockCache& Cache() {
+		static thread_local BlockCache cache{};
+		return cache;
+	}
+
+public:
+	using value_type = T;
+
+	PoolAllocator() = default;
+
+	template<typename U>
+	PoolAllocator(const PoolAllocator<U>&) noexcept { }
+
+	T* allocate(size_t count) {
+		if (count != 1) {
+			return static_cast<T*>(::operator new(count * sizeof(T)));
+		}
+
+		auto& cache = Cache();
+
+		if (cache.blocks.empty()) {
+			return static_cast<T*>(::operator new(sizeof(T)));
+		}
+
+		auto block = cache.blocks.back();
+		cache.blocks.pop_back();
+
+		return static_cast<T*>(block);
+	}
+
+	void deallocate(T* pointer, size_t count) {
+		auto& cache = Cache();
+
+		if (count != 1 || cache.blocks.size() >= max_cached) {
+			::operator delete(pointer);
+			return;
+		}
+
+		cache.blocks.emplace_back(pointer);
+	}
+
+	template<typename U>
+	bool operator==(const PoolAllocator<U>&) const noexcept {
+		return true;
+	}
+
+	template<typename U>
+	bool operator!=(const PoolAllocator<U>&) const noexcept {
+		return false;
+	}
+};
+
+// Holds either the value or the exception of a future, whichever is set first. A
+// continuation receives both and checks the exception before it touches the value.
+template<typename T>
+class FutureState {
+	std::mutex mutex{};
+	std::condition_variable condition{};
+
+	std::optional<T> value{};
+	std::exception_ptr error{};
+	std::function<void(std::optional<T>&&, std::exception_ptr)> continuation{};
+	bool inline_continuation{};
+
+	static void RunContinuation(std::shared_ptr<FutureState<T>> state) {
+		state->continuation(std::move(state->value), state->error);
+		state->continuation = nullptr;
+	}
+
+	static void Dispatch(std::shared_ptr<FutureState<T>> state) {
+		if (state->inline_continuation) {
+			RunContinuation(std::move(state));
+			return;
+		}
+
+		Scheduler::Instance().Submit([state]() {
+			RunContinuation(state);
+		});
+	}
+
+	static void Settle(std::shared_ptr<FutureState<T>> state, std::unique_lock<std::mutex>& lock) {
+		if (state->continuation) {
+			lock.unlock();
+			Dispatch(std::move(state));
+			return;
+		}
+
+		state->condition.notify_all();
+	}
+
+	bool HasResult() const {
+		return value.has_value() || error;
+	}
+
+public:
+	static std::shared_ptr<FutureState<T>> create() {
+		return std::allocate_shared<FutureState<T>>(PoolAllocator<FutureState<T>>{});
+	}
+
+	static void SetValue(std::shared_ptr<FutureState<T>> state, T&& new_value) {
+		std::unique_lock<std::mutex> lock(state->mutex);
+
+		assert(!state->HasResult() && "The value was already set");
+		state->value.emplace(std::move(new_value));
+
+		Settle(std::move(state), lock);
+	}
+
+	static void SetException(std::shared_ptr<FutureState<T>> state, std::exception_ptr new_error) {
+		std::unique_lock<std::mutex> lock(state->mutex);
+
+		assert(!state->HasResult() && "The value was already set");
+		state->error = new_error;
+
+		Settle(std::move(state), lock);
+	}
+
+	// An inline continuation runs in the thread that sets the result, or in the caller if the
+	// result is already there, instead of as a scheduler task.
+	static void SetContinuation(std::shared_ptr<FutureState<T>> state,
+		std::function<void(std::optional<T>&&, std::exception_ptr)> new_continuation, bool run_inline = false) {
+		std::unique_lock<std::mutex> lock(state->mutex);
+
+		assert(!state->continuation && "A future can only have one continuation");
+		state->continuation = std::move(new_continuation);
+		state->inline_continuation = run_inline;
+
+		if (state->HasResult()) {
+			lock.unlock();
+			Dispatch(std::move(state));
+		}
+	}
+
+	bool IsReady() {
+		std::lock_guard<std::mutex> lock(mutex);
+		return HasResult();
+	}
+
+	T Get() {
+		Scheduler::Instance().Block([this]() {
+			std::unique_lock<std::mutex> lock(mutex);
+			condition.wait(lock, [this]() { return HasResult(); });
+		});
+
+		std::lock_guard<std::mutex> lock(mutex);
+
+		if (error) {
+			std::rethrow_exception(error);
+		}
+
+		return std::move(*value);
+	}
+};
+
+template<typename T>
+class Future;
+
+template<typename T>
+class Promise {
+	std::shared_ptr<FutureState<T>> state{};
+
+public:
+	Promise() : state(FutureState<T>::create()) { }
+
+	Future<T> GetFuture() const {
+		return Future<T>(state);
+	}
+
+	void SetValue(T value) {
+		FutureState<T>::SetValue(state, std::move(value));
+	}
+
+	void SetException(std::exception_ptr error) {
+		FutureState<T>::SetException(state, error);
+	}
+};
+
+// A single-consumer future whose continuations are scheduled once the value arrives,
+// so no worker has to sit in a blocking get() to move data to the next stage.
+template<typename T>
+class Future {
+	template<typename U>
+	friend class Promise;
+
+	std::shared_ptr<FutureState<T>> state{};
+
+	explicit Future(std::shared_ptr<FutureState<T>> state) : state(std::move(state)) { }
+
+	template<typename Function, typename ErrorFunction>
+	void Attach(Function function, ErrorFunction on_error, bool run_inline) {
+		assert(Valid() && "The future has no state");
+
+		FutureState<T>::SetContinuation(std::move(state), [function, on_error](std::optional<T>&& value, std::exception_ptr error) mutable {
+			if (!error) {
+				try {
+					function(std::move(*value));
+					return;
+				}
+				catch (...) {
+					error = std::current_exception();
+				}
+			}
+
+			on_error(error);
+		}, run_inline);
+	}
+
+public:
+	Future() = default;
+
+	Future(const Future& other) = delete;
+	Future(Future&& other) = default;
+
+	Future& operator=(const Future& other) = delete;
+	Future& operator=(Future&& other) = default;
+
+	bool Valid() const noexcept {
+		return static_cast<bool>(state);
+	}
+
+	bool IsReady() const {
+		assert(Valid() && "The future has no state");
+		return state->IsReady();
+	}
+
+	// An exception of this future skips the function and goes to the returned future, as
+	// does an exception thrown by the function.
+	template<typename Function, typename T_result = std::invoke_result_t<Function, T&&>>
+	Future<T_result> Then(Function function) {
+		static_assert(!std::is_void_v<T_result>, "Use Finally for continuations without a result");
+		assert(Valid() && "The future has no state");
+
+		Promise<T_result> promise{};
+		auto result = promise.GetFuture();
+
+		FutureState<T>::SetContinuation(std::move(state), [function, promise](std::optional<T>&& value, std::exception_ptr error) mutable {
+			if (error) {
+				promise.SetException(error);
+				return;
+			}
+
+			try {
+				promise.SetValue(function(std::move(*value)));
+			}
+			catch (...) {
+				promise.SetException(std::current_exception());
+			}
+		});
+
+		return result;
+	}
+
+	// Calls function with the value, or on_error with the exception of this future or the
+	// one thrown by function, so whatever waits on the continuation is always released.
+	template<typename Function, typename ErrorFunction>
+	void Finally(Function function, ErrorFunction on_error) {
+		Attach(std::move(function), std::move(on_error), false);
+	}
+
+	// Finally without the scheduler task, for short hand-offs such as setting another
+	// promise or pushing into a queue. Nothing that computes belongs here.
+	template<typename Function, typename ErrorFunction>
+	void FinallyInline(Function function, ErrorFunction on_error) {
+		Attach(std::move(function), std::move(on_error), true);
+	}
+
+	T Get() {
+		assert(Valid() && "The future has no state");
+
+		auto local_state = std::move(state);
+		return local_state->Get();
+	}
+};
+
+template<typename T>
+Future<T> make_ready_future(T value) {
+	Promise<T> promise{};
+	promise.SetValue(std::move(value));
+	return promise.GetFuture();
+}
+
+// Moves the value or the exception of a ready std::future into the promise.
+template<typename T>
+void settle_from_future(std::future<T>& future, Promise<T>& promise) {
+	try {
+		promise.SetValue(future.get());
+	}
+	catch (...) {
+		promise.SetException(std::current_exception());
+	}
+}
+
+template<typename T>
+void poll_to_promise(std::shared_ptr<std::future<T>> future, Promise<T> promise) {
+	if (future->wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+		settle_from_future(*future, promise);
+		return;
+	}
+
+	Scheduler::Instance().Defer([future, promise]() {
+		poll_to_promise(future, promise);
+	});
+}
+
+// A std::future has no continuation, so it is polled as a deferred scheduler task until
+// it is ready instead of keeping a worker in a blocking get().
+template<typename T>
+void forward_to_promise(std::future<T> future, Promise<T> promise) {
+	if (future.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+		settle_from_future(future, promise);
+		return;
+	}
+
+	poll_to_promise(std::make_shared<std::future<T>>(std::move(future)), std::move(promise));
+}
+
+template<typename T>
+Future<T> to_future(std::future<T> future) {
+	Promise<T> promise{};
+	auto result = promise.GetFuture();
+
+	forward_to_promise(std::move(future), std::move(promise));
+
+	return result;
+}
+
+template<typename T>
+void forward_to_promise(Future<T> future, std::promise<T> promise) {
+	auto shared_promise = std::make_shared<std::promise<T>>(std::move(promise));
+
+	future.FinallyInline([shared_promise](T&& value) {
+		shared_promise->set_value(std::move(value));
+	}, [shared_promise](std::exception_ptr error) {
+		shared_promise->set_exception(error);
+	});
+}
+
+template<typename T>
+void forward_to_promise(Future<T> future, Promise<T> promise) {
+	future.FinallyInline([promise](T&& value) mutable {
+		promise.SetValue(std::move(value));
+	}, [promise](std::exception_ptr error) mutable {
+		promise.SetException(error);
+	});
+}
+
+// Resolves with the values of all futures in their order once the last one has arrived, or
+// with the first exception among them.
+template<typename T>
+Future<std::vector<T>> when_all(std::vector<Future<T>> futures) {
+	struct Gather {
+		std::vector<std::optional<T>> values;
+		std::atomic<size_t> remaining;
+		std::atomic<bool> failed{};
+		Promise<std::vector<T>> promise{};
+
+		explicit Gather(size_t count) : values(count), remaining(count) { }
+	};
+
+	if (futures.empty()) {
+		return make_ready_future(std::vector<T>{});
+	}
+
+	auto gather = std::make_shared<Gather>(futures.size());
+	auto result = gather->promise.GetFuture();
+
+	for (size_t i = 0; i < futures.size(); i++) {
+		futures[i].FinallyInline([gather, i](T&& value) {
+			gather->values[i].emplace(std::move(value));
+
+			if (gather->remaining.fetch_sub(1) != 1) {
+				return;
+			}
+
+			std::vector<T> values{};
+			values.reserve(gather->values.size());
+
+			for (auto& element : gather->values) {
+				values.emplace_back(std::move(*element));
+			}
+
+			gather->promise.SetValue(std::move(values));
+		}, [gather](std::exception_ptr error) {
+			if (!gather->failed.exchange(true)) {
+				gather->promise.SetException(error);
+			}
+		});
+	}
+
+	return result;
+}
@@ -1,12 +1,17 @@
 #pragma once
 
 #include "../Commons.hpp"
+#include "Future.hpp"
 #include "ThreadSafeQueue.hpp"
+#include "Scheduler.hpp"
+#include "Task.hpp"
 
 #include <cassert>
+#include <exception>
 #include <future>
 #include <string>
 #include <memory>
+#include <vector>
 
 template<typename T_input, typename T_output>
 class PatternInterface {
@@ -15,20 +20,88 @@ class PatternInterface {
 
 	virtual void InternallyCompute(std::future<T_input>, std::promise<T_output>) = 0;
 
+	virtual bool InternallyTryCompute(std::future<T_input>& future, std::promise<T_output>& promise) {
+		InternallyCompute(std::move(future), std::move(promise));
+		return true;
+	}
+
+	// The input has already arrived, only the output is waited for.
 	virtual T_output InternallyComputePure(T_input&& input) {
-		std::promise<T_input> promise_input{};
-		auto future_input = promise_input.get_future();
-		promise_input.set_value(std::move(input));
+		return InternallyComputeAsync(make_ready_future(std::move(input))).Get();
+	}
+
+	// Hands the input to InternallyCompute once it has arrived and forwards the result
+	// without waiting for it, so a pattern that queues its work holds no worker meanwhile.
+	virtual Future<T_output> InternallyComputeAsync(Future<T_input> input) {
+		Promise<T_output> promise{};
+		auto output = promise.GetFuture();
+
+		input.Finally([this, promise](T_input&& value) {
+			std::promise<T_input> promise_input{};
+			auto future_input = promise_input.get_future();
+			promise_input.set_value(std::move(value));
 
-		std::promise<T_output> promise_output{};
-		auto future_output = promise_output.get_future();
+			std::promise<T_output> promise_output{};
+			auto future_output = promise_output.get_future();
 
-		InternallyCompute(std::move(future_input), std::move(promise_output));
+			InternallyCompute(std::move(future_input), std::move(promise_output));
 
-		return future_output.get();
+			forward_to_promise(std::move(future_output), promise);
+		}, [promise](std::exception_ptr error) mutable {
+			promise.SetException(error);
+		});
+
+		return output;
+	}
+
+#if defined(CPA_COROUTINES)
+	virtual Task<T_output> InternallyComputeTask(T_input input) {
+		co_return co_await InternallyComputeAsync(make_ready_future(std::move(input)));
 	}
+#endif
 
 protected:
+	// Blocking patterns run the batch in one scheduler task once it has arrived. Others get
+	// one InternallyComputeAsync per element, and the outputs are gathered as they complete,
+	// so no worker waits for an element.
+	virtual Future<std::vector<T_output>> InternallyComputeBatchAsync(Future<std::vector<T_input>> input) {
+		if (IsBlocking()) {
+			return input.Then([this](std::vector<T_input>&& inputs) {
+				std::vector<T_output> outputs{};
+				outputs.reserve(inputs.size());
+
+				for (auto& value : inputs) {
+					outputs.emplace_back(InternallyComputePure(std::move(value)));
+				}
+
+				return outputs;
+			});
+		}
+
+		Promise<std::vector<T_output>> promise{};
+		auto output = promise.GetFuture();
+
+		input.Finally([this, promise](std::vector<T_input>&& inputs) {
+			std::vector<Future<T_output>> outputs{};
+			outputs.reserve(inputs.size());
+
+			for (auto& value : inputs) {
+				outputs.emplace_back(InternallyComputeAsync(make_ready_future(std::move(value))));
+			}
+
+			forward_to_promise(when_all(std::move(outputs)), promise);
+		}, [promise](std::exception_ptr error) mutable {
+			promise.SetException(error);
+		});
+
+		return output;
+	}
+
+	// Neither waits for the batch nor for its outputs on the caller.
+	virtual void InternallyComputeBatch(std::future<std::vector<T_input>> future, std::promise<std::vector<T_output>> promise) {
+		forward_to_promise(InternallyComputeBatchAsync(to_future(std::move(future))), std::move(promise));
+	}
+
 	std::atomic<bool> initialized = ATOMIC_VAR_INIT(false);
 	std::atomic<bool> dying = ATOMIC_VAR_INIT(false);
 
@@ -66,10 +139,57 @@ public:
 		return result;
 	}
 
+	// Hands the whole batch to the pattern as one unit, so queues and promises are paid per
+	// batch instead of per element.
+	std::future<std::vector<T_output>> ComputeBatch(std::future<std::vector<T_input>> future) {
+		std::promise<std::vector<T_output>> promise{};
+		auto result = promise.get_future();
+
+		InternallyComputeBatch(std::move(future), std::move(promise));
+
+		return result;
+	}
+
+	std::future<std::vector<T_output>> ComputeBatch(std::vector<T_input> inputs) {
+		std::promise<std::vector<T_input>> promise{};
+		auto future = promise.get_future();
+		promise.set_value(std::move(inputs));
+
+		return ComputeBatch(std::move(future));
+	}
+
+	Future<std::vector<T_output>> ComputeBatchAsync(Future<std::vector<T_input>> input) {
+		return InternallyComputeBatchAsync(std::move(input));
+	}
+
+	// Leaves the input untouched and returns false if a bounded queue of the pattern is at
+	// its high-water mark, Compute() would block until there is room instead.
+	bool TryCompute(std::future<T_input>& future, std::future<T_output>& result) {
+		std::promise<T_output> promise{};
+		auto output = promise.get_future();
+
+		if (!InternallyTryCompute(future, promise)) {
+			return false;
+		}
+
+		result = std::move(output);
+		return true;
+	}
+
 	T_output ComputePure(T_input&& input) {
 		return InternallyComputePure(std::move(input));
 	}
 
+	Future<T_output> ComputeAsync(Future<T_input> input) {
+		return InternallyComputeAsync(std::move(input));
+	}
+
+#if defined(CPA_COROUTINES)
+	Task<T_output> ComputeTask(T_input input) {
+		return InternallyComputeTask(std::move(input));
+	}
+#endif
+
 	virtual size_t ThreadCount() const noexcept = 0;
 
 	virtual std::string Name() const = 0;
@@ -78,6 +198,11 @@ public:
 		return false;
 	}
 
+	// Inputs that were handed to the pattern but still wait in one of its queues.
+	virtual size_t Backlog() const noexcept {
+		return 0;
+	}
+
 	virtual void Init() = 0;
 	virtual void Dispose() = 0;
 
@@ -0,0 +1,476 @@
+#pragma once
+
+#include "../Commons.hpp"
+#include "ThreadSafeQueue.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Process-wide work-stealing runtime. Every pattern submits its work here instead of
+// owning threads, so a nested composition runs on WorkerCount() active threads.
+// A worker that has to block is compensated by a spare thread for the time it waits,
+// and workers without work park on the injection queue instead of spinning.
+class Scheduler {
+public:
+	using Task = std::function<void()>;
+
+	static constexpr const size_t no_worker = std::numeric_limits<size_t>::max();
+
+	// A worker that keeps finding other work still runs a deferred task after this many.
+	static constexpr const size_t deferred_interval = 64;
+
+	// Idle workers park no longer than this while deferred tasks wait, which bounds how late
+	// a polled std::future is noticed once it is ready.
+	static constexpr const std::chrono::microseconds deferred_poll_interval = std::chrono::microseconds(50);
+
+private:
+	struct Worker {
+		std::deque<Task> tasks{};
+		std::mutex mutex{};
+		std::thread thread{};
+	};
+
+	std::vector<std::unique_ptr<Worker>> workers{};
+	TSBlockingQueue<Task> injection_queue{};
+	std::atomic<size_t> parked_workers{};
+
+	TSQueue<Task> deferred_queue{};
+	std::atomic<size_t> deferred_count{};
+
+	std::vector<std::thread> spares{};
+	std::mutex spare_mutex{};
+	std::condition_variable spare_condition{};
+
+	size_t blocked{};
+	size_t running_spares{};
+	size_t parked_spares{};
+	size_t wakeups{};
+
+	std::atomic<bool> stopping = ATOMIC_VAR_INIT(false);
+
+	static inline thread_local size_t worker_index = no_worker;
+	static inline thread_local bool scheduler_thread = false;
+	static inline thread_local size_t acquired = 0;
+
+	Scheduler() {
+		auto worker_count = std::max(1u, std::thread::hardware_concurrency());
+
+		for (unsigned i = 0; i < worker_count; i++) {
+			workers.emplace_back(std::make_unique<Worker>());
+		}
+
+		for (unsigned i = 0; i < worker_count; i++) {
+			workers[i]->thread = std::thread(&Scheduler::RunWorker, this, i);
+		}
+	}
+
+	bool PopLocal(Task& task) {
+		auto& worker = *workers[worker_index];
+		std::lock_guard<std::mutex> lock(worker.mutex);
+
+		if (worker.tasks.empty()) {
+			return false;
+		}
+
+		task = std::move(worker.tasks.back());
+		worker.tasks.pop_back();
+
+		return true;
+	}
+
+	bool Steal(Task& task) {
+		const auto worker_count = workers.size();
+		const auto start = worker_index == no_worker ? 0 : worker_index + 1;
+
+		for (size_t i = 0; i < worker_count; i++) {
+			auto victim_index = (start + i) % worker_count;
+
+			if (victim_index == worker_index) {
+				continue;
+			}
+
+			auto& victim = *workers[victim_index];
+			std::lock_guard<std::mutex> lock(victim.mutex);
+
+			if (victim.tasks.empty()) {
+				continue;
+			}
+
+			task = std::move(victim.tasks.front());
+			victim.tasks.pop_front();
+
+			return true;
+		}
+
+		return false;
+	}
+
+	bool TryAcquire(Task& task) {
+		if (acquired >= deferred_interval) {
+			acquired = 0;
+
+			if (PopDeferred(task)) {
+				return true;
+			}
+		}
+
+		auto success = (worker_index != no_worker && PopLocal(task)) || injection_queue.try_pop(task) || Steal(task);
+
+		if (success) {
+			acquired++;
+		}
+
+		return success;
+	}
+
+	bool PopDeferred(Task& task) {
+		if (!deferred_queue.try_pop(task)) {
+			return false;
+		}
+
+		deferred_count.fetch_sub(1);
+		return true;
+	}
+
+	// Runs the tasks that were deferred when it started, the ones they defer again wait for
+	// the next round.
+	void RunDeferred() {
+		auto count = deferred_count.load();
+		Task task{};
+
+		for (size_t i = 0; i < count && PopDeferred(task); i++) {
+			task();
+		}
+	}
+
+	// A worker without work runs the deferred tasks on every idle round and parks only for
+	// deferred_poll_interval while any are left, so a task that defers itself again runs
+	// about that often while there is nothing else to do.
+	void Idle(SpinThenPark& idle) {
+		if (deferred_count.load() > 0) {
+			RunDeferred();
+		}
+
+		if (!idle.ShouldPark()) {
+			return;
+		}
+
+		auto timeout = deferred_count.load() > 0 ? deferred_poll_interval : idle.ParkTimeout();
+		Task task{};
+
+		parked_workers.fetch_add(1);
+		bool success = injection_queue.wait_pop(task, timeout);
+		parked_workers.fetch_sub(1);
+
+		if (success) {
+			idle.Reset();
+			task();
+		}
+	}
+
+	void RunWorker(size_t index) {
+		worker_index = index;
+		scheduler_thread = true;
+
+		SpinThenPark idle{};
+
+		while (!stopping) {
+			if (RunOne()) {
+				idle.Reset();
+				continue;
+			}
+
+			Idle(idle);
+		}
+	}
+
+	bool ParkSpare() {
+		std::unique_lock<std::mutex> lock(spare_mutex);
+
+		while (!stopping && running_spares > blocked) {
+			running_spares--;
+			parked_spares++;
+
+			spare_condition.wait(lock, [this]() { return stopping || wakeups > 0; });
+
+			parked_spares--;
+
+			if (stopping) {
+				return false;
+			}
+
+			wakeups--;
+		}
+
+		return !stopping;
+	}
+
+	void RunSpare() {
+		scheduler_thread = true;
+
+		SpinThenPark idle{};
+
+		while (ParkSpare()) {
+			if (RunOne()) {
+				idle.Reset();
+				continue;
+			}
+
+			Idle(idle);
+		}
+	}
+
+	void EnterBlocking() {
+		std::lock_guard<std::mutex> lock(spare_mutex);
+
+		blocked++;
+
+		if (running_spares >= blocked) {
+			return;
+		}
+
+		running_spares++;
+
+		if (parked_spares > wakeups) {
+			wakeups++;
+			spare_condition.notify_one();
+			return;
+		}
+
+		spares.emplace_back(&Scheduler::RunSpare, this);
+	}
+
+	void LeaveBlocking() {
+		std::lock_guard<std::mutex> lock(spare_mutex);
+		blocked--;
+	}
+
+public:
+	static Scheduler& Instance() {
+		static Scheduler scheduler{};
+		return scheduler;
+	}
+
+	Scheduler(const Scheduler& other) = delete;
+	Scheduler(Scheduler&& other) = delete;
+
+	Scheduler& operator=(const Scheduler& other) = delete;
+	Scheduler& operator=(Scheduler&& other) = delete;
+
+	~Scheduler() {
+		{
+			std::lock_guard<std::mutex> lock(spare_mutex);
+			stopping = true;
+		}
+
+		spare_condition.notify_all();
+
+		for (auto& worker : workers) {
+			if (worker->thread.joinable()) {
+				worker->thread.join();
+			}
+		}
+
+		for (auto& spare : spares) {
+			if (spare.joinable()) {
+				spare.join();
+			}
+		}
+	}
+
+	void Submit(Task task) {
+		if (worker_index == no_worker || parked_workers.load() > 0) {
+			injection_queue.push(std::move(task));
+			return;
+		}
+
+		auto& worker = *workers[worker_index];
+		std::lock_guard<std::mutex> lock(worker.mutex);
+		worker.tasks.emplace_back(std::move(task));
+	}
+
+	// For tasks that poll for something outside the scheduler. They run behind all other
+	// work, so a task that defers itself until its condition holds does not starve it.
+	void Defer(Task task) {
+		deferred_count.fetch_add(1);
+		deferred_queue.push(std::move(task));
+
+		// A parked worker would only see the task at the end of its park timeout.
+		if (parked_workers.load() > 0) {
+			injection_queue.push([]() { });
+		}
+	}
+
+	bool RunOne() {
+		Task task{};
+
+		if (!TryAcquire(task)) {
+			return false;
+		}
+
+		task();
+
+		return true;
+	}
+
+	size_t WorkerCount() const noexcept {
+		return workers.size();
+	}
+
+	static size_t WorkerIndex() noexcept {
+		return worker_index;
+	}
+
+	static bool IsWorker() noexcept {
+		return scheduler_thread;
+	}
+
+	template<typename Blocker>
+	void Block(Blocker blocker) {
+		if (!IsWorker()) {
+			blocker();
+			return;
+		}
+
+		EnterBlocking();
+		blocker();
+		LeaveBlocking();
+	}
+
+	template<typename Predicate>
+	void WaitUntil(Predicate predicate) {
+		if (predicate()) {
+			return;
+		}
+
+		Block([&predicate]() {
+			SpinThenPark idle(64, std::chrono::microseconds(100));
+
+			while (!predicate()) {
+				if (idle.ShouldPark()) {
+					std::this_thread::sleep_for(idle.ParkTimeout());
+				}
+			}
+		});
+	}
+
+	template<typename T>
+	void Wait(const std::future<T>& future) {
+		if (future.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+			return;
+		}
+
+		Block([&future]() {
+			future.wait();
+		});
+	}
+};
+
+template<typename T>
+T await_future(std::future<T>& future) {
+	Scheduler::Instance().Wait(future);
+	return future.get();
+}
+
+template<typename T>
+T await_future(std::future<T>&& future) {
+	return await_future(future);
+}
+
+class TaskGroup {
+	std::atomic<size_t> pending{};
+
+public:
+	TaskGroup() = default;
+
+	TaskGroup(const TaskGroup& other) = delete;
+	TaskGroup(TaskGroup&& other) = delete;
+
+	TaskGroup& operator=(const TaskGroup& other) = delete;
+	TaskGroup& operator=(TaskGroup&& other) = delete;
+
+	~TaskGroup() {
+		Wait();
+	}
+
+	void Run(Scheduler::Task task) {
+		pending.fetch_add(1);
+
+		Scheduler::Instance().Submit([this, task = std::move(task)]() {
+			task();
+			pending.fetch_sub(1);
+		});
+	}
+
+	void Wait() {
+		Scheduler::Instance().WaitUntil([this]() {
+			return pending.load() == 0;
+		});
+	}
+};
+
+// Caps how many scheduler tasks drain a pattern's queue at once, which keeps the
+// parallelism a pattern was created with (e.g. the thread count of a TaskPool).
+class WorkerSlots {
+	std::atomic<size_t> active{};
+	std::atomic<size_t> notifications{};
+	size_t limit{};
+
+	bool TryAcquire() {
+		if (active.fetch_add(1) < limit) {
+			return true;
+		}
+
+		active.fetch_sub(1);
+		return false;
+	}
+
+public:
+	explicit WorkerSlots(size_t limit = 1) : limit(limit) { }
+
+	WorkerSlots(const WorkerSlots& other) = delete;
+	WorkerSlots(WorkerSlots&& other) = delete;
+
+	WorkerSlots& operator=(const WorkerSlots& other) = delete;
+	WorkerSlots& operator=(WorkerSlots&& other) = delete;
+
+	size_t Limit() const noexcept {
+		return limit;
+	}
+
+	// step() is only called while a slot is held. A drainer that gives its slot back looks for
+	// notifications that arrived while it was draining, their Notify found no free slot, so
+	// the drainer takes a slot again and drains once more.
+	template<typename Step>
+	void Notify(TaskGroup& group, Step step) {
+		notifications.fetch_add(1);
+
+		if (!TryAcquire()) {
+			return;
+		}
+
+		group.Run([this, step]() {
+			while (true) {
+				auto seen = notifications.load();
+
+				while (step()) { }
+
+				active.fetch_sub(1);
+
+				if (notifications.load() == seen || !TryAcquire()) {
+					return;
+				}
+			}
+		});
+	}
+};
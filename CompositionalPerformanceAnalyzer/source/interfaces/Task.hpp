@@ -0,0 +1,202 @@
+#pragma once
+
+#if defined(CPA_COROUTINES)
+
+#include "../Commons.hpp"
+#include "Future.hpp"
+#include "Scheduler.hpp"
+
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <utility>
+
+// Lazily started coroutine that yields a single value. A suspended stage only holds its
+// frame, the scheduler resumes it once the awaited stage has produced its result.
+template<typename T>
+class Task {
+public:
+	struct promise_type {
+		std::optional<T> value{};
+		std::exception_ptr error{};
+		std::coroutine_handle<> continuation{};
+
+		Task get_return_object() {
+			return Task(std::coroutine_handle<promise_type>::from_promise(*this));
+		}
+
+		std::suspend_always initial_suspend() noexcept {
+			return {};
+		}
+
+		auto final_suspend() noexcept {
+			struct FinalAwaiter {
+				bool await_ready() noexcept {
+					return false;
+				}
+
+				std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> handle) noexcept {
+					auto continuation = handle.promise().continuation;
+					return continuation ? continuation : std::noop_coroutine();
+				}
+
+				void await_resume() noexcept { }
+			};
+
+			return FinalAwaiter{};
+		}
+
+		void return_value(T new_value) {
+			value.emplace(std::move(new_value));
+		}
+
+		void unhandled_exception() {
+			error = std::current_exception();
+		}
+	};
+
+private:
+	std::coroutine_handle<promise_type> handle{};
+
+	explicit Task(std::coroutine_handle<promise_type> handle) : handle(handle) { }
+
+public:
+	Task(const Task& other) = delete;
+	Task(Task&& other) noexcept : handle(std::exchange(other.handle, {})) { }
+
+	Task& operator=(const Task& other) = delete;
+	Task& operator=(Task&& other) noexcept {
+		if (this != &other) {
+			if (handle) {
+				handle.destroy();
+			}
+
+			handle = std::exchange(other.handle, {});
+		}
+
+		return *this;
+	}
+
+	~Task() {
+		if (handle) {
+			handle.destroy();
+		}
+	}
+
+	bool await_ready() const noexcept {
+		return false;
+	}
+
+	std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept {
+		handle.promise().continuation = awaiting;
+		return handle;
+	}
+
+	T await_resume() {
+		if (handle.promise().error) {
+			std::rethrow_exception(handle.promise().error);
+		}
+
+		return std::move(*handle.promise().value);
+	}
+
+	Future<T> ToFuture() &&;
+};
+
+// Moves the awaiting coroutine onto a scheduler worker unless it already runs on one.
+struct ScheduleOnWorker {
+	bool await_ready() const noexcept {
+		return Scheduler::IsWorker();
+	}
+
+	void await_suspend(std::coroutine_handle<> handle) {
+		Scheduler::Instance().Submit([handle]() {
+			handle.resume();
+		});
+	}
+
+	void await_resume() noexcept { }
+};
+
+template<typename T>
+class FutureAwaiter {
+	Future<T> future{};
+	std::optional<T> value{};
+	std::exception_ptr error{};
+
+public:
+	explicit FutureAwaiter(Future<T>&& future) : future(std::move(future)) { }
+
+	bool await_ready() const {
+		return false;
+	}
+
+	void await_suspend(std::coroutine_handle<> handle) {
+		future.Finally([this, handle](T&& result) {
+			value.emplace(std::move(result));
+			handle.resume();
+		}, [this, handle](std::exception_ptr new_error) {
+			error = new_error;
+			handle.resume();
+		});
+	}
+
+	T await_resume() {
+		if (error) {
+			std::rethrow_exception(error);
+		}
+
+		return std::move(*value);
+	}
+};
+
+template<typename T>
+FutureAwaiter<T> operator co_await(Future<T>&& future) {
+	return FutureAwaiter<T>(std::move(future));
+}
+
+struct DetachedTask {
+	struct promise_type {
+		DetachedTask get_return_object() noexcept {
+			return {};
+		}
+
+		std::suspend_never initial_suspend() noexcept {
+			return {};
+		}
+
+		std::suspend_never final_suspend() noexcept {
+			return {};
+		}
+
+		void return_void() noexcept { }
+
+		void unhandled_exception() {
+			std::terminate();
+		}
+	};
+};
+
+template<typename T>
+DetachedTask run_detached(Task<T> task, Promise<T> promise) {
+	co_await ScheduleOnWorker{};
+
+	try {
+		promise.SetValue(co_await std::move(task));
+	}
+	catch (...) {
+		promise.SetException(std::current_exception());
+	}
+}
+
+template<typename T>
+Future<T> Task<T>::ToFuture() && {
+	Promise<T> promise{};
+	auto result = promise.GetFuture();
+
+	run_detached(std::move(*this), promise);
+
+	return result;
+}
+
+#endif
@@ -4,11 +4,14 @@
 #include "../Commons.hpp"
 
 #include "concurrentqueue-master/concurrentqueue.h"
+#include "concurrentqueue-master/blockingconcurrentqueue.h"
 
 #include <atomic>
+#include <chrono>
 #include <memory>
 #include <mutex>
 #include <queue>
+#include <thread>
 
 
 namespace QueueImplementations {
@@ -43,8 +46,115 @@ namespace QueueImplementations {
 			return queue.try_dequeue(value);
 		}
 	};
+
+	// Counts elements against a high-water mark. A slot is reserved before an element is
+	// pushed and freed when it is popped again, a mark of 0 leaves the queue unbounded.
+	template<typename T>
+	class BoundedCameronQueue :public QueueInterface<T> {
+		moodycamel::ConcurrentQueue<T> queue;
+
+		std::atomic<size_t> occupied{};
+		size_t high_water_mark{};
+
+	public:
+		explicit BoundedCameronQueue(size_t high_water_mark = 0) : high_water_mark(high_water_mark) { }
+
+		void push(T new_val) override {
+			occupied.fetch_add(1);
+			queue.enqueue(std::move(new_val));
+		}
+
+		bool try_pop(T& value) override {
+			if (!queue.try_dequeue(value)) {
+				return false;
+			}
+
+			occupied.fetch_sub(1);
+			return true;
+		}
+
+		bool try_reserve() {
+			auto previous = occupied.fetch_add(1);
+
+			if (high_water_mark == 0 || previous < high_water_mark) {
+				return true;
+			}
+
+			occupied.fetch_sub(1);
+			return false;
+		}
+
+		void release() {
+			occupied.fetch_sub(1);
+		}
+
+		void push_reserved(T new_val) {
+			queue.enqueue(std::move(new_val));
+		}
+
+		size_t size_approx() const noexcept {
+			return occupied.load();
+		}
+
+		size_t capacity() const noexcept {
+			return high_water_mark;
+		}
+	};
+
+	template<typename T>
+	class BlockingCameronQueue :public QueueInterface<T> {
+		moodycamel::BlockingConcurrentQueue<T> queue;
+
+	public:
+		void push(T new_val) override {
+			queue.enqueue(std::move(new_val));
+		}
+
+		bool try_pop(T& value) override {
+			return queue.try_dequeue(value);
+		}
+
+		bool wait_pop(T& value, std::chrono::microseconds timeout) {
+			return queue.wait_dequeue_timed(value, timeout);
+		}
+	};
 }
 
 template<typename T>
 using TSQueue = QueueImplementations::RefCountingCameronQueue<T>;
 
+template<typename T>
+using TSBoundedQueue = QueueImplementations::BoundedCameronQueue<T>;
+
+template<typename T>
+using TSBlockingQueue = QueueImplementations::BlockingCameronQueue<T>;
+
+class SpinThenPark {
+	size_t spin_limit{};
+	std::chrono::microseconds park_timeout{};
+
+	size_t spins{};
+
+public:
+	explicit SpinThenPark(size_t spin_limit = 64, std::chrono::microseconds park_timeout = std::chrono::microseconds(1000))
+		: spin_limit(spin_limit), park_timeout(park_timeout) { }
+
+	void Reset() noexcept {
+		spins = 0;
+	}
+
+	bool ShouldPark() {
+		if (spins < spin_limit) {
+			spins++;
+			std::this_thread::yield();
+			return false;
+		}
+
+		return true;
+	}
+
+	std::chrono::microseconds ParkTimeout() const noexcept {
+		return park_timeout;
+	}
+};
+
@@ -3,24 +3,81 @@
 #include "../Commons.hpp"
 #include "../interfaces/PatternInterface.hpp"
 #include "../interfaces/Executor.hpp"
+#include "../interfaces/Future.hpp"
+#include "../interfaces/Task.hpp"
+
+#include <exception>
 
 template<typename T_input, typename T_intermediate, typename T_output>
 class Composition : public PatternInterface<T_input, T_output> {
 	Executor<T_input, T_intermediate> executor1{};
 	Executor<T_intermediate, T_output> executor2{};
 
+	// Both sides run synchronously in the calling thread (e.g. two AlgorithmWrappers), so
+	// the whole chain is a plain call and needs no hop between the two stages.
+	bool blocking_chain{};
+
 	Composition(PatIntPtr<T_input, T_intermediate>& interface1, PatIntPtr<T_intermediate, T_output>& interface2)
-		: executor1(interface1), executor2(interface2) { }
+		: executor1(interface1), executor2(interface2), blocking_chain(executor1.IsBlocking() && executor2.IsBlocking()) { }
 
 protected:
 	void InternallyCompute(std::future<T_input> future, std::promise<T_output> promise) override {
-		std::promise<T_intermediate> intermediate_promise;
-		std::future<T_intermediate> intermediate_future = intermediate_promise.get_future();
+		if (blocking_chain) {
+			try {
+				auto input = await_future(future);
+				promise.set_value(InternallyComputePure(std::move(input)));
+			}
+			catch (...) {
+				promise.set_exception(std::current_exception());
+			}
+
+			return;
+		}
+
+		auto output = InternallyComputeAsync(to_future(std::move(future)));
+		forward_to_promise(std::move(output), std::move(promise));
+	}
+
+	Future<std::vector<T_output>> InternallyComputeBatchAsync(Future<std::vector<T_input>> input) override {
+		if (blocking_chain) {
+			return PatternInterface<T_input, T_output>::InternallyComputeBatchAsync(std::move(input));
+		}
+
+		auto intermediate = executor1.ComputeBatchAsync(std::move(input));
+		return executor2.ComputeBatchAsync(std::move(intermediate));
+	}
+
+	T_output InternallyComputePure(T_input&& input) override {
+		if (blocking_chain) {
+			return executor2.Compute(executor1.Compute(std::move(input)));
+		}
 
-		executor1.Compute(std::move(future), std::move(intermediate_promise));
-		executor2.Compute(std::move(intermediate_future), std::move(promise));
+		return InternallyComputeAsync(make_ready_future(std::move(input))).Get();
 	}
 
+	Future<T_output> InternallyComputeAsync(Future<T_input> input) override {
+		if (blocking_chain) {
+			return input.Then([this](T_input&& value) {
+				return InternallyComputePure(std::move(value));
+			});
+		}
+
+		auto intermediate = executor1.ComputeAsync(std::move(input));
+		return executor2.ComputeAsync(std::move(intermediate));
+	}
+
+#if defined(CPA_COROUTINES)
+	Task<T_output> InternallyComputeTask(T_input input) override {
+		if (blocking_chain) {
+			co_await ScheduleOnWorker{};
+			co_return InternallyComputePure(std::move(input));
+		}
+
+		auto intermediate = co_await executor1.ComputeTask(std::move(input));
+		co_return co_await executor2.ComputeTask(std::move(intermediate));
+	}
+#endif
+
 public:
 	static PatIntPtr<T_input, T_output> create
 	(PatIntPtr<T_input, T_intermediate> interface1, PatIntPtr<T_intermediate, T_output> interface2) {
@@ -68,6 +125,10 @@ public:
 		return executor1.ThreadCount() + executor2.ThreadCount();
 	}
 
+	bool IsBlocking() const noexcept override {
+		return blocking_chain;
+	}
+
 	std::string Name() const override {
 		return std::string("composition(") + executor1.Name() + std::string(",") + executor2.Name() + std::string(")");
 	}
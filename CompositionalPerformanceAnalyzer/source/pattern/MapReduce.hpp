@@ -3,83 +3,631 @@
 #include "../Commons.hpp"
 #include "../interfaces/PatternInterface.hpp"
 #include "../interfaces/Executor.hpp"
+#include "../interfaces/Scheduler.hpp"
+
+#include "../algorithms/Partitioner.hpp"
 
 #include "../helper/mpi_helper.hpp"
+#include "../helper/radixsort.hpp"
 
 #include <mpi.h>
 
+#include <algorithm>
 #include <atomic>
 #include <chrono>
 #include <future>
-#include <thread>
 #include <vector>
 #include <cassert>
+#include <climits>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iterator>
 #include <memory>
 #include <map>
 #include <mutex>
-#include <shared_mutex>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <unordered_map>
+
+
+constexpr const size_t default_shard_count = 64;
+
+// A shard that has spilled this often merges its runs into one, so reloading a shard never
+// reads from more run files at once.
+constexpr const size_t max_runs_per_shard = 16;
+
+// Groups values by key. The key space is split into shards by hash, each shard grows on
+// demand and has its own lock, so any hashable key type works and adds to different
+// shards never contend.
+// With a memory budget (in bytes of buffered keys and values) a shard that is added to
+// while the collection is over budget writes its values to a run file sorted by key and
+// starts over empty, so the collection stays within about twice the budget. Spilling
+// writes keys and values as raw bytes, so it needs trivially copyable types.
+// The runs of a shard are merged entry by entry. Still, consume hands over a whole shard,
+// so after a spill it holds about the spilled bytes divided by the shard count in memory.
+template<typename T_key, typename T_value>
+class ThreadSafeKeyedCollection {
+	static constexpr const bool can_spill = std::is_trivially_copyable_v<T_key> && std::is_trivially_copyable_v<T_value>;
 
+	typedef std::map<T_key, std::vector<T_value>> shard_values;
 
-constexpr const int pre_size = 768;
+	struct Shard {
+		std::mutex mutex{};
+		std::unordered_map<T_key, std::vector<T_value>> values{};
+		size_t bytes{};
+		std::vector<std::filesystem::path> runs{};
+	};
 
-template<typename T_key, typename T_value>
-class ThreadSafeKeyedCollection {
-	std::vector<std::unique_ptr<std::mutex>> mutexes{};
-	std::vector<std::vector<T_value>> values{};
+	std::vector<std::unique_ptr<Shard>> shards{};
+
+	size_t memory_budget{};
+	std::atomic<size_t> buffered_bytes{};
+
+	std::filesystem::path spill_directory{};
+	std::atomic<size_t> run_count{};
+
+	Shard& ShardOf(const T_key& key) {
+		auto index = std::hash<T_key>{}(key) % shards.size();
+		return *shards[index];
+	}
+
+	void Account(Shard& shard, size_t bytes) {
+		shard.bytes += bytes;
+		auto buffered = buffered_bytes.fetch_add(bytes) + bytes;
+
+		// Only shards holding at least their share of the budget spill, which keeps tiny run
+		// files from being written while the collection hovers around the budget.
+		if (memory_budget != 0 && buffered > memory_budget && shard.bytes * shards.size() >= memory_budget) {
+			Spill(shard);
+		}
+	}
+
+	// Reads a run one entry at a time.
+	struct RunReader {
+		std::ifstream input;
+
+		T_key key{};
+		std::vector<T_value> values{};
+		bool valid{};
+
+		explicit RunReader(const std::filesystem::path& path) : input(path, std::ios::in | std::ios::binary) {
+			Next();
+		}
+
+		void Next() {
+			size_t count{};
+
+			valid = input.read(reinterpret_cast<char*>(&key), sizeof(T_key))
+				&& input.read(reinterpret_cast<char*>(&count), sizeof(size_t));
+
+			if (!valid) {
+				return;
+			}
+
+			values.resize(count);
+			valid = static_cast<bool>(input.read(reinterpret_cast<char*>(values.data()), sizeof(T_value) * count));
+		}
+	};
+
+	static void WriteEntry(std::ofstream& output, const T_key& key, const std::vector<T_value>& values) {
+		size_t count = values.size();
+
+		output.write(reinterpret_cast<const char*>(&key), sizeof(T_key));
+		output.write(reinterpret_cast<const char*>(&count), sizeof(size_t));
+		output.write(reinterpret_cast<const char*>(values.data()), sizeof(T_value) * count);
+	}
+
+	std::filesystem::path NextRunPath() {
+		std::filesystem::create_directories(spill_directory);
+		return spill_directory / ("run_" + std::to_string(run_count.fetch_add(1)) + ".bin");
+	}
+
+	// Runs hold each key once and in order, so they are merged holding one entry per run.
+	// Every key reaches function once, with its values in the order the runs were written.
+	template<typename Function>
+	static void MergeRuns(const std::vector<std::filesystem::path>& runs, Function function) {
+		std::vector<std::unique_ptr<RunReader>> readers{};
+		readers.reserve(runs.size());
+
+		for (auto& run : runs) {
+			readers.emplace_back(std::make_unique<RunReader>(run));
+		}
 
-	std::shared_mutex containment_mutex{};
+		while (true) {
+			RunReader* lowest = nullptr;
+
+			for (auto& reader : readers) {
+				if (reader->valid && (lowest == nullptr || reader->key < lowest->key)) {
+					lowest = reader.get();
+				}
+			}
+
+			if (lowest == nullptr) {
+				return;
+			}
+
+			auto key = lowest->key;
+			std::vector<T_value> values{};
+
+			for (auto& reader : readers) {
+				if (!reader->valid || key < reader->key) {
+					continue;
+				}
+
+				if (values.empty()) {
+					values = std::move(reader->values);
+				}
+				else {
+					values.insert(values.end(), reader->values.begin(), reader->values.end());
+				}
+
+				reader->Next();
+			}
+
+			function(key, values);
+		}
+	}
+
+	static void RemoveRuns(std::vector<std::filesystem::path>& runs) {
+		for (auto& run : runs) {
+			std::filesystem::remove(run);
+		}
+
+		runs.clear();
+	}
+
+	// Expects the lock of the shard to be held.
+	void CompactRuns(Shard& shard) {
+		if constexpr (can_spill) {
+			auto path = NextRunPath();
+			std::ofstream output(path, std::ios::out | std::ios::binary);
+
+			MergeRuns(shard.runs, [&output](const T_key& key, std::vector<T_value>& values) {
+				WriteEntry(output, key, values);
+			});
+
+			output.close();
+
+			if (!output.good()) {
+				throw std::runtime_error("Could not write spill file " + path.string());
+			}
+
+			RemoveRuns(shard.runs);
+			shard.runs.emplace_back(std::move(path));
+		}
+	}
+
+	// Expects the lock of the shard to be held.
+	void Spill(Shard& shard) {
+		if constexpr (can_spill) {
+			if (shard.values.empty()) {
+				return;
+			}
+
+			auto path = NextRunPath();
+
+			std::vector<const std::pair<const T_key, std::vector<T_value>>*> entries{};
+			entries.reserve(shard.values.size());
+
+			for (auto& entry : shard.values) {
+				entries.emplace_back(&entry);
+			}
+
+			std::sort(entries.begin(), entries.end(), [](auto* first, auto* second) { return first->first < second->first; });
+
+			std::ofstream output(path, std::ios::out | std::ios::binary);
+
+			for (auto* entry : entries) {
+				WriteEntry(output, entry->first, entry->second);
+			}
+
+			// The run may be read back right away by CompactRuns.
+			output.close();
+
+			if (!output.good()) {
+				throw std::runtime_error("Could not write spill file " + path.string());
+			}
+
+			shard.runs.emplace_back(std::move(path));
+			shard.values.clear();
+
+			buffered_bytes.fetch_sub(shard.bytes);
+			shard.bytes = 0;
+
+			if (shard.runs.size() >= max_runs_per_shard) {
+				CompactRuns(shard);
+			}
+		}
+	}
+
+	// Expects the lock of the shard to be held.
+	void TakeShard(Shard& shard, shard_values& result) {
+		if constexpr (can_spill) {
+			MergeRuns(shard.runs, [&result](const T_key& key, std::vector<T_value>& values) {
+				result.emplace_hint(result.end(), key, std::move(values));
+			});
+
+			RemoveRuns(shard.runs);
+		}
+
+		for (auto& [key, vec] : shard.values) {
+			auto& target = result[key];
+
+			if (target.empty()) {
+				target = std::move(vec);
+			}
+			else {
+				target.insert(target.end(), std::make_move_iterator(vec.begin()), std::make_move_iterator(vec.end()));
+			}
+		}
+
+		shard.values.clear();
+
+		buffered_bytes.fetch_sub(shard.bytes);
+		shard.bytes = 0;
+	}
 
 public:
-	ThreadSafeKeyedCollection() :mutexes(pre_size), values(pre_size) {
-		for (T_key key = 0; key < pre_size; key++) {
-			mutexes[key] = std::move(std::make_unique<std::mutex>());
+	explicit ThreadSafeKeyedCollection(size_t shard_count = default_shard_count, size_t memory_budget = 0)
+		: shards(shard_count), memory_budget(memory_budget) {
+		assert(shard_count > 0 && "Need at least one shard");
+		assert((memory_budget == 0 || can_spill) && "Spilling needs trivially copyable keys and values");
+
+		for (auto& shard : shards) {
+			shard = std::make_unique<Shard>();
+		}
+
+		if (memory_budget != 0) {
+			spill_directory = std::filesystem::temp_directory_path() / ("cpa_spill_" + std::to_string(std::random_device{}()));
+		}
+	}
+
+	ThreadSafeKeyedCollection(const ThreadSafeKeyedCollection& other) = delete;
+	ThreadSafeKeyedCollection(ThreadSafeKeyedCollection&& other) = delete;
+
+	ThreadSafeKeyedCollection& operator=(const ThreadSafeKeyedCollection& other) = delete;
+	ThreadSafeKeyedCollection& operator=(ThreadSafeKeyedCollection&& other) = delete;
+
+	~ThreadSafeKeyedCollection() {
+		if (spilled()) {
+			std::error_code error{};
+			std::filesystem::remove_all(spill_directory, error);
 		}
 	}
 
 	void preAddKeys(std::vector<T_key>& vector) {
-		std::unique_lock<std::shared_mutex> lock(containment_mutex);
+		for (auto& key : vector) {
+			auto& shard = ShardOf(key);
+			std::lock_guard<std::mutex> lock(shard.mutex);
 
-		for (auto key : vector) {
-			mutexes[key] = std::move(std::make_unique<std::mutex>());
-			values[key] = std::vector<T_value>{};
+			shard.values[key];
 		}
 	}
 
 	void add(const T_key& key, T_value& value) {
-		std::unique_ptr<std::mutex>& mutex = mutexes[key];
-		mutex->lock();
+		auto& shard = ShardOf(key);
+		std::lock_guard<std::mutex> lock(shard.mutex);
 
-		std::vector<T_value>& vec = values[key];
+		std::vector<T_value>& vec = shard.values[key];
 		vec.emplace_back(value);
 
-		mutex->unlock();
+		Account(shard, sizeof(T_value) + (vec.size() == 1 ? sizeof(T_key) : 0));
 	}
 
 	void add(const T_key& key, std::vector<T_value>& vals) {
-		std::unique_ptr<std::mutex>& mutex = mutexes[key];
-		mutex->lock();
+		auto& shard = ShardOf(key);
+		std::lock_guard<std::mutex> lock(shard.mutex);
+
+		std::vector<T_value>& vec = shard.values[key];
+		auto is_new = vec.empty();
 
-		std::vector<T_value>& vec = values[key];
 		vec.insert(vec.end(), vals.begin(), vals.end());
 
-		mutex->unlock();
+		Account(shard, sizeof(T_value) * vals.size() + (is_new ? sizeof(T_key) : 0));
 	}
 
-	void get(std::vector<std::vector<T_value>>& result) {
-		result = std::move(values);
-		values = std::vector<std::vector<T_value>>{};
-		mutexes = std::vector<std::unique_ptr<std::mutex>>{};
+	// Only counts the keys that are held in memory.
+	size_t size() {
+		auto count = 0ull;
+
+		for (auto& shard : shards) {
+			std::lock_guard<std::mutex> lock(shard->mutex);
+			count += shard->values.size();
+		}
+
+		return count;
+	}
+
+	bool spilled() const noexcept {
+		return run_count.load() > 0;
 	}
 
 	void get(std::map<T_key, std::vector<T_value>>& result) {
-		for (T_key key = 0; key < pre_size; key++) {
-			result[key] = std::move(values[key]);
+		for (auto& shard : shards) {
+			std::lock_guard<std::mutex> lock(shard->mutex);
+
+			if (shard->runs.empty()) {
+				for (auto& [key, vec] : shard->values) {
+					result[key] = std::move(vec);
+				}
+
+				shard->values.clear();
+
+				buffered_bytes.fetch_sub(shard->bytes);
+				shard->bytes = 0;
+
+				continue;
+			}
+
+			shard_values values{};
+			TakeShard(*shard, values);
+
+			result.merge(values);
 		}
-		values = std::vector<std::vector<T_value>>(768);
-		mutexes = std::vector<std::unique_ptr<std::mutex>>(768);
+	}
 
-		for (T_key key = 0; key < pre_size; key++) {
-			mutexes[key] = std::move(std::make_unique<std::mutex>());
+	// Hands the values to function one shard at a time, so after a spill only one shard is
+	// back in memory at once. Empty shards are handed over as well, so collections with the
+	// same shard count call function equally often, e.g. once per shuffle round on every rank.
+	template<typename Function>
+	void consume(Function function) {
+		for (auto& shard : shards) {
+			shard_values values{};
+
+			{
+				std::lock_guard<std::mutex> lock(shard->mutex);
+				TakeShard(*shard, values);
+			}
+
+			function(values);
+		}
+	}
+};
+
+
+// How the mapped values are grouped by key. Hashed adds every value to a shard of a
+// ThreadSafeKeyedCollection under the shard's lock. Sorted appends (key, value) pairs to a
+// flat buffer per worker and groups them by sorting once all values are there.
+enum class ShuffleMode : int {
+	Hashed,
+	Sorted
+};
+
+// Collects (key, value) pairs in one flat buffer per scheduler worker (threads outside the
+// scheduler share a last buffer), so adding never contends on a shared lock. Taking the
+// values out scatters the pairs into one bucket per buffer by key hash, sorts every bucket
+// on its own scheduler task (radix sort for integral keys) and cuts the sorted buckets into
+// contiguous per-key ranges.
+template<typename T_key, typename T_value>
+class SortedKeyedCollection {
+	typedef std::pair<T_key, T_value> pair;
+	typedef std::map<T_key, std::vector<T_value>> shard_values;
+
+	struct Buffer {
+		std::mutex mutex{};
+		std::vector<pair> pairs{};
+	};
+
+	std::vector<std::unique_ptr<Buffer>> buffers{};
+
+	Buffer& LocalBuffer() {
+		auto index = Scheduler::WorkerIndex();
+
+		if (index == Scheduler::no_worker || index >= buffers.size() - 1) {
+			return *buffers.back();
+		}
+
+		return *buffers[index];
+	}
+
+	static void Group(std::vector<pair>& pairs, shard_values& result) {
+		sort_by_key(pairs);
+
+		for (size_t begin = 0; begin < pairs.size();) {
+			auto end = begin + 1;
+
+			while (end < pairs.size() && !(pairs[begin].first < pairs[end].first)) {
+				end++;
+			}
+
+			auto& vec = result.emplace_hint(result.end(), std::move(pairs[begin].first), std::vector<T_value>{})->second;
+			vec.reserve(end - begin);
+
+			for (auto i = begin; i < end; i++) {
+				vec.emplace_back(std::move(pairs[i].second));
+			}
+
+			begin = end;
+		}
+
+		pairs.clear();
+	}
+
+public:
+	SortedKeyedCollection() : buffers(Scheduler::Instance().WorkerCount() + 1) {
+		for (auto& buffer : buffers) {
+			buffer = std::make_unique<Buffer>();
+		}
+	}
+
+	SortedKeyedCollection(const SortedKeyedCollection& other) = delete;
+	SortedKeyedCollection(SortedKeyedCollection&& other) = delete;
+
+	SortedKeyedCollection& operator=(const SortedKeyedCollection& other) = delete;
+	SortedKeyedCollection& operator=(SortedKeyedCollection&& other) = delete;
+
+	void add(const T_key& key, T_value& value) {
+		auto& buffer = LocalBuffer();
+		std::lock_guard<std::mutex> lock(buffer.mutex);
+
+		buffer.pairs.emplace_back(key, value);
+	}
+
+	void add(const T_key& key, std::vector<T_value>& vals) {
+		auto& buffer = LocalBuffer();
+		std::lock_guard<std::mutex> lock(buffer.mutex);
+
+		for (auto& value : vals) {
+			buffer.pairs.emplace_back(key, value);
+		}
+	}
+
+	void get(std::map<T_key, std::vector<T_value>>& result) {
+		consume([&result](shard_values& values) {
+			result.merge(values);
+		});
+	}
+
+	// Hands the grouped values to function one bucket at a time.
+	template<typename Function>
+	void consume(Function function) {
+		const auto bucket_count = buffers.size();
+
+		std::vector<std::vector<std::vector<pair>>> scattered(buffers.size());
+		std::vector<shard_values> grouped(bucket_count);
+
+		{
+			TaskGroup group{};
+
+			for (size_t source = 0; source < buffers.size(); source++) {
+				group.Run([this, &scattered, source, bucket_count]() {
+					auto& buffer = *buffers[source];
+					std::lock_guard<std::mutex> lock(buffer.mutex);
+
+					auto& targets = scattered[source];
+					targets.resize(bucket_count);
+
+					for (auto& entry : buffer.pairs) {
+						auto bucket = std::hash<T_key>{}(entry.first) % bucket_count;
+						targets[bucket].emplace_back(std::move(entry));
+					}
+
+					buffer.pairs.clear();
+				});
+			}
+
+			group.Wait();
+
+			for (size_t bucket = 0; bucket < bucket_count; bucket++) {
+				group.Run([&scattered, &grouped, bucket]() {
+					std::vector<pair> pairs{};
+
+					for (auto& targets : scattered) {
+						auto& part = targets[bucket];
+						pairs.insert(pairs.end(), std::make_move_iterator(part.begin()), std::make_move_iterator(part.end()));
+						part = std::vector<pair>{};
+					}
+
+					Group(pairs, grouped[bucket]);
+				});
+			}
+
+			group.Wait();
+		}
+
+		for (auto& values : grouped) {
+			if (!values.empty()) {
+				function(values);
+			}
+		}
+	}
+
+	bool spilled() const noexcept {
+		return false;
+	}
+};
+
+
+// Pre-aggregates mapped values in one buffer per scheduler worker (threads outside the
+// scheduler share a last buffer), so a hot key costs one locked add to the keyed collection
+// per worker instead of one per mapped value.
+template<typename T_key, typename T_value>
+class ShuffleCombiner {
+	struct Buffer {
+		std::mutex mutex{};
+		std::unordered_map<T_key, T_value> values{};
+	};
+
+	AlgoIntPtr<std::tuple<T_value, T_value>, T_value> combiner{};
+	std::vector<std::unique_ptr<Buffer>> buffers{};
+
+	Buffer& LocalBuffer() {
+		auto index = Scheduler::WorkerIndex();
+
+		if (index == Scheduler::no_worker || index >= buffers.size() - 1) {
+			return *buffers.back();
+		}
+
+		return *buffers[index];
+	}
+
+public:
+	explicit ShuffleCombiner(AlgoIntPtr<std::tuple<T_value, T_value>, T_value> combiner)
+		: combiner(combiner), buffers(Scheduler::Instance().WorkerCount() + 1) {
+		for (auto& buffer : buffers) {
+			buffer = std::make_unique<Buffer>();
+		}
+	}
+
+	ShuffleCombiner(const ShuffleCombiner& other) = delete;
+	ShuffleCombiner(ShuffleCombiner&& other) = delete;
+
+	ShuffleCombiner& operator=(const ShuffleCombiner& other) = delete;
+	ShuffleCombiner& operator=(ShuffleCombiner&& other) = delete;
+
+	void add(const T_key& key, T_value& value) {
+		auto& buffer = LocalBuffer();
+		std::lock_guard<std::mutex> lock(buffer.mutex);
+
+		auto entry = buffer.values.find(key);
+
+		if (entry == buffer.values.end()) {
+			buffer.values.emplace(key, value);
+			return;
+		}
+
+		entry->second = combiner->Compute(std::make_tuple(std::move(entry->second), value));
+	}
+
+	template<typename T_collection>
+	void flush(T_collection& tskc) {
+		for (auto& buffer : buffers) {
+			std::lock_guard<std::mutex> lock(buffer->mutex);
+
+			for (auto& [key, value] : buffer->values) {
+				tskc.add(key, value);
+			}
+
+			buffer->values.clear();
+		}
+	}
+
+	// Combines the buffers into result while leaving them untouched.
+	void get(std::map<T_key, T_value>& result) {
+		for (auto& buffer : buffers) {
+			std::lock_guard<std::mutex> lock(buffer->mutex);
+
+			for (auto& [key, value] : buffer->values) {
+				auto entry = result.find(key);
+
+				if (entry == result.end()) {
+					result.emplace(key, value);
+					continue;
+				}
+
+				entry->second = combiner->Compute(std::make_tuple(std::move(entry->second), value));
+			}
+		}
+	}
+
+	void clear() {
+		for (auto& buffer : buffers) {
+			std::lock_guard<std::mutex> lock(buffer->mutex);
+			buffer->values.clear();
 		}
 	}
 };
@@ -90,20 +638,29 @@ class MapReduceGlobalH : public PatternInterface<FutVec<T_input>, std::map<T_key
 
 	typedef std::map<T_key, T_map_result> map_result;
 	typedef std::map<T_key, T_output> end_result;
+	typedef std::map<T_key, std::vector<T_output>> value_block;
 
-	std::vector<std::thread> threads{};
+	size_t thread_count{};
 
 	Executor<T_input, map_result> mapper{};
 	Executor<std::vector<T_output>, T_output> reducer{};
 
 	AlgoIntPtr<T_key, int> distributer{};
+	std::shared_ptr<Partitioner<T_key>> partitioner{};
+	AlgoIntPtr<std::tuple<T_output, T_output>, T_output> combiner{};
+	size_t memory_budget{};
+	ShuffleMode shuffle_mode{};
+	bool split_hot_keys{};
 
 	TSQueue<std::tuple<std::future<T_input>, std::promise<map_result>>> map_queue{};
-	TSQueue<std::tuple<std::future<map_result>, ThreadSafeKeyedCollection<T_key, T_output>*, std::promise<void>>> shuffle_queue{};
-	TSQueue<std::tuple<std::future<std::vector<T_output>>, std::promise<T_output>>> reduce_queue{};
+	TSQueue<std::tuple<std::future<map_result>, ThreadSafeKeyedCollection<T_key, T_output>*, SortedKeyedCollection<T_key, T_output>*, ShuffleCombiner<T_key, T_output>*, std::promise<void>>> shuffle_queue{};
+	TSQueue<std::tuple<value_block, std::promise<end_result>>> reduce_queue{};
 
 	size_t mpi_nodes{};
 
+	WorkerSlots slots;
+	TaskGroup tasks{};
+
 	bool PerformMapFunction() {
 		std::tuple<std::future<T_input>, std::promise<map_result>> tuple{};
 
@@ -122,7 +679,7 @@ class MapReduceGlobalH : public PatternInterface<FutVec<T_input>, std::map<T_key
 	}
 
 	bool PerformShuffleFunction() {
-		std::tuple<std::future<map_result>, ThreadSafeKeyedCollection<T_key, T_output>*, std::promise<void>> tuple_queue{};
+		std::tuple<std::future<map_result>, ThreadSafeKeyedCollection<T_key, T_output>*, SortedKeyedCollection<T_key, T_output>*, ShuffleCombiner<T_key, T_output>*, std::promise<void>> tuple_queue{};
 
 		auto success = shuffle_queue.try_pop(tuple_queue);
 
@@ -132,12 +689,33 @@ class MapReduceGlobalH : public PatternInterface<FutVec<T_input>, std::map<T_key
 
 		auto future = std::move(std::get<0>(tuple_queue));
 		auto tskc = std::move(std::get<1>(tuple_queue));
-		auto promise = std::move(std::get<2>(tuple_queue));
+		auto sorting = std::move(std::get<2>(tuple_queue));
+		auto combining = std::move(std::get<3>(tuple_queue));
+		auto promise = std::move(std::get<4>(tuple_queue));
 
-		auto result = future.get();
+		auto result = await_future(future);
+
+		if constexpr (std::is_same_v<T_map_result, T_output>) {
+			if (combining != nullptr) {
+				for (auto& [key, value] : result) {
+					combining->add(key, value);
+				}
+
+				promise.set_value();
+
+				return true;
+			}
+		}
 
-		for (auto [key, value] : result) {
-			tskc->add(key, value);
+		if (sorting != nullptr) {
+			for (auto& [key, value] : result) {
+				sorting->add(key, value);
+			}
+		}
+		else {
+			for (auto& [key, value] : result) {
+				tskc->add(key, value);
+			}
 		}
 
 		promise.set_value();
@@ -146,7 +724,7 @@ class MapReduceGlobalH : public PatternInterface<FutVec<T_input>, std::map<T_key
 	}
 
 	bool PerformReduceFunction() {
-		std::tuple<std::future<std::vector<T_output>>, std::promise<T_output>> tuple_queue{};
+		std::tuple<value_block, std::promise<end_result>> tuple_queue{};
 
 		auto success = reduce_queue.try_pop(tuple_queue);
 
@@ -154,267 +732,437 @@ class MapReduceGlobalH : public PatternInterface<FutVec<T_input>, std::map<T_key
 			return false;
 		}
 
-		auto future = std::move(std::get<0>(tuple_queue));
+		auto block = std::move(std::get<0>(tuple_queue));
 		auto promise = std::move(std::get<1>(tuple_queue));
 
-		reducer.Compute(std::move(future), std::move(promise));
+		end_result result{};
+
+		for (auto& [key, vals] : block) {
+			result.emplace_hint(result.end(), key, reducer.Compute(std::move(vals)));
+		}
+
+		promise.set_value(std::move(result));
 
 		return true;
 	}
 
-	void Perform() {
-		while (!this->dying) {
-			bool success_map = PerformMapFunction();
+	bool Perform() {
+		return PerformMapFunction() || PerformShuffleFunction() || PerformReduceFunction();
+	}
+
+	void Notify() {
+		slots.Notify(tasks, [this]() { return Perform(); });
+	}
+
+
+	std::future<end_result> QueueReduce(value_block&& block) {
+		std::promise<end_result> prom;
+		std::future<end_result> fut = prom.get_future();
+
+		reduce_queue.push(std::make_tuple(std::move(block), std::move(prom)));
+		Notify();
+
+		return fut;
+	}
+
+	// Cuts the values into a few blocks per thread, balanced by value count rather than key
+	// count, so a reduce task amortizes its queueing over many small reductions. With
+	// split_hot_keys a hot key with more values than a block is split into sub-reductions
+	// whose partial results are merged afterwards, which relies on the reducer being
+	// associative. Blocks are queued largest key first, so the stragglers start early.
+	void QueueReduces(value_block& values, std::vector<std::future<end_result>>& partials) {
+		if (values.empty()) {
+			return;
+		}
+
+		auto value_count = 0ull;
+
+		std::vector<typename value_block::iterator> keys_by_size{};
+		keys_by_size.reserve(values.size());
+
+		for (auto it = values.begin(); it != values.end(); ++it) {
+			value_count += it->second.size();
+			keys_by_size.emplace_back(it);
+		}
+
+		std::sort(keys_by_size.begin(), keys_by_size.end(), [](const auto& first, const auto& second) {
+			return first->second.size() > second->second.size();
+		});
+
+		const auto block_size = std::max<size_t>(1, value_count / (4 * thread_count));
+
+		value_block block{};
+		auto block_values = 0ull;
+
+		for (auto& it : keys_by_size) {
+			auto& vec = it->second;
+
+			if (split_hot_keys && vec.size() > block_size) {
+				for (size_t begin = 0; begin < vec.size(); begin += block_size) {
+					auto end = std::min(begin + block_size, vec.size());
+
+					value_block split{};
+					split.emplace(it->first, std::vector<T_output>(std::make_move_iterator(vec.begin() + begin), std::make_move_iterator(vec.begin() + end)));
+
+					partials.emplace_back(QueueReduce(std::move(split)));
+				}
 
-			if (success_map) {
 				continue;
 			}
 
-			bool success_shuffle = PerformShuffleFunction();
+			block_values += vec.size();
+			block.emplace(it->first, std::move(vec));
 
-			if (success_shuffle) {
-				continue;
+			if (block_values >= block_size) {
+				partials.emplace_back(QueueReduce(std::move(block)));
+				block = value_block{};
+				block_values = 0;
 			}
+		}
 
-			bool success_reduce = PerformReduceFunction();
+		if (!block.empty()) {
+			partials.emplace_back(QueueReduce(std::move(block)));
+		}
 
-			if (success_reduce) {
+		values.clear();
+	}
+
+	// Combines the results of two ranks or blocks, a key found in both is reduced once more.
+	void MergeResults(end_result& mine, end_result& received) {
+		if (mine.empty()) {
+			mine = std::move(received);
+			return;
+		}
+
+		for (auto& [key, value] : received) {
+			auto entry = mine.find(key);
+
+			if (entry == mine.end()) {
+				mine.emplace(key, std::move(value));
 				continue;
 			}
 
-			std::this_thread::yield();
+			entry->second = reducer.Compute(std::vector<T_output>{ std::move(entry->second), std::move(value) });
 		}
 	}
 
+	// The ranks of all keys in the order of values. A Partitioner assigns them in one batch,
+	// other distributers key by key. A partitioner that uses a histogram then learns the
+	// number of values per key of this run, summed over the ranks.
+	std::vector<int> Distribute(const value_block& values) {
+		std::vector<int> destinations{};
+
+		if (!partitioner) {
+			destinations.reserve(values.size());
 
-	void MergeMaps(std::map<T_key, std::vector<T_output>>& lhs, std::map<T_key, std::vector<T_output>>& rhs) {
-		for (auto [key, vec] : rhs) {
-			std::vector<T_output>& lhs_vec = lhs[key];
-			lhs_vec.insert(lhs_vec.end(), vec.begin(), vec.end());
+			for (auto& [key, vec] : values) {
+				destinations.emplace_back(distributer->Compute(T_key(key)));
+			}
+
+			return destinations;
 		}
-	}
 
-	void SendToNode(int index, std::map<T_key, std::vector<T_output>>& to_send) {
 		std::vector<T_key> keys{};
-		std::vector<int> sizes{};
+		keys.reserve(values.size());
 
-		for (auto [key, value] : to_send) {
+		for (auto& [key, vec] : values) {
 			keys.emplace_back(key);
-			sizes.emplace_back(to_send[key].size());
 		}
 
-		size_t size = to_send.size();
-		mpi_send_size(index, size);
-
-		mpi_send_global(keys, index);
-		mpi_send_global(sizes, index);
+		partitioner->ComputeBatch(keys, destinations);
 
-		for (auto i = 0; i < size; i++) {
-			std::vector<T_output>& vec = to_send[keys[i]];
-			mpi_send_global(vec, index);
-		}
-	}
+		if (partitioner->UsesHistogram()) {
+			std::map<T_key, size_t> histogram{};
 
-	void ReceiveFromNode(int index, std::map<T_key, std::vector<T_output>>& to_receive) {
-		size_t count = mpi_receive_size(index);
-
-		auto keys = new T_key[count];
-		auto sizes = new int[count];
+			for (auto& [key, vec] : values) {
+				histogram.emplace_hint(histogram.end(), key, vec.size());
+			}
 
-		mpi_receive_global(keys, count, index);
-		mpi_receive_global(sizes, count, index);
+			mpi_tree_reduce_map(histogram, static_cast<int>(mpi_nodes), [](std::map<T_key, size_t>& mine, std::map<T_key, size_t>& received) {
+				for (auto& [key, count] : received) {
+					mine[key] += count;
+				}
+			});
 
-		for (auto j = 0; j < count; j++) {
-			auto vec = std::vector<T_output>(sizes[j]);
-			mpi_receive_global(vec.data(), sizes[j], index);
+			mpi_broadcast_object(histogram, 0);
 
-			to_receive[keys[j]] = std::move(vec);
+			partitioner->Observe(histogram);
 		}
 
-		delete[] keys;
-		delete[] sizes;
+		return destinations;
 	}
 
-	void CommunicateWithNode(int src_idx, int dst_idx, std::map<T_key, std::vector<T_output>>& to_send, std::map<T_key, std::vector<T_output>>& to_receive) {
-		if (src_idx < dst_idx) {
-			SendToNode(dst_idx, to_send);
-			ReceiveFromNode(dst_idx, to_receive);
-		}
-		else {
-			ReceiveFromNode(dst_idx, to_receive);
-			SendToNode(dst_idx, to_send);
+	// Appends the values of every rank to those of the same key in rank order, so each key
+	// is reduced once over all of its values.
+	static value_block Gather(std::vector<value_block>& blocks) {
+		value_block gathered{};
+
+		for (auto& block : blocks) {
+			for (auto& [key, vec] : block) {
+				auto& target = gathered[key];
+
+				if (target.empty()) {
+					target = std::move(vec);
+				}
+				else {
+					target.insert(target.end(), std::make_move_iterator(vec.begin()), std::make_move_iterator(vec.end()));
+				}
+			}
+
+			block.clear();
 		}
+
+		return gathered;
 	}
 
-	void ShuffleNodes(std::map<T_key, std::vector<T_output>>& values) {
+	// The keys of every other rank are packed with their values into one message per rank,
+	// whose size is announced by an all-to-all, and sent without blocking. The values of a
+	// key are gathered from all ranks before the key is reduced. With split_hot_keys the
+	// reducer is associative anyway, so the keys this rank owns are reduced while the
+	// messages are in flight and the values of a peer as soon as its message has arrived.
+	void ShuffleNodes(value_block& values, std::vector<std::future<end_result>>& partials) {
 		if (mpi_nodes < 2) {
+			QueueReduces(values, partials);
 			return;
 		}
 
-		std::vector<std::map<T_key, std::vector<T_output>>> individual_maps(mpi_nodes);
-
-		for (auto it = values.begin(); it != values.end(); it++) {
-			auto key = it->first;
-			auto value = std::move(it->second);
+		const auto ranks = mpi_get_global_size();
+		const auto rank = mpi_get_global_rank();
+		assert(mpi_nodes <= static_cast<size_t>(ranks) && "The node is not available");
 
-			int node_to_receive_this_key = distributer->Compute(std::move(key));
+		auto destinations = Distribute(values);
 
-			assert(node_to_receive_this_key < mpi_nodes && "The node is not available");
+		std::vector<std::vector<typename value_block::iterator>> send_entries(ranks);
+		std::vector<size_t> send_bytes(ranks);
 
-			std::map<T_key, std::vector<T_output>>& map = individual_maps[node_to_receive_this_key];
-			map[it->first] = std::move(value);
-		}
+		auto destination = destinations.begin();
 
-		int mpi_rank = -1;
-		mpi_get_global_rank(&mpi_rank);
+		for (auto it = values.begin(); it != values.end(); ++it, ++destination) {
+			int node_to_receive_this_key = *destination;
 
-		std::map<T_key, std::vector<T_output>>& mine = individual_maps[mpi_rank];
+			assert(node_to_receive_this_key < mpi_nodes && "The node is not available");
 
-		for (auto i = 0; i < mpi_nodes; i++) {
-			if (i == mpi_rank) {
+			if (node_to_receive_this_key == rank) {
 				continue;
 			}
 
-			std::map<T_key, std::vector<T_output>> tmp_dst_map;
-			std::map<T_key, std::vector<T_output>>& src_map = individual_maps[i];
+			send_entries[node_to_receive_this_key].emplace_back(it);
+			send_bytes[node_to_receive_this_key] += mpi_serializer<T_key>::size(it->first) + mpi_serializer<std::vector<T_output>>::size(it->second);
+		}
 
-			CommunicateWithNode(mpi_rank, i, src_map, tmp_dst_map);
+		std::vector<std::vector<char>> send_buffers(ranks);
+		std::vector<int> send_counts(ranks);
+		std::vector<int> receive_counts(ranks);
 
-			MergeMaps(mine, tmp_dst_map);
-		}
+		for (auto i = 0; i < ranks; i++) {
+			assert(send_bytes[i] <= static_cast<size_t>(INT_MAX) && "The message is too large");
 
-		values = std::move(mine);
-	}
+			send_buffers[i].resize(send_bytes[i]);
+			send_counts[i] = static_cast<int>(send_bytes[i]);
 
-	MapReduceGlobalH(PatIntPtr<T_input, map_result> mapper_task, PatIntPtr<std::vector<T_output>, T_output> reducer_task, size_t threads, size_t mpi_nodes,
-		AlgoIntPtr<T_key, int> distributer)
-		: mapper(mapper_task), reducer(reducer_task), threads(threads), mpi_nodes(mpi_nodes), distributer(distributer) {
-	}
+			auto* out = send_buffers[i].data();
 
-	void ReduceAtEnd(end_result& mr) {
-		size_t size = mr.size();
+			for (auto& entry : send_entries[i]) {
+				mpi_serializer<T_key>::write(out, entry->first);
+				mpi_serializer<std::vector<T_output>>::write(out, entry->second);
 
-		if (mpi_nodes < 2) {
-			return;
+				values.erase(entry);
+			}
 		}
 
-		int mpi_rank = -1;
+		mpi_all_to_all_global(send_counts.data(), receive_counts.data(), 1);
+
+		std::vector<std::vector<char>> receive_buffers(ranks);
 
-		mpi_get_global_rank(&mpi_rank);
+		std::vector<MPI_Request> send_requests{};
+		std::vector<MPI_Request> receive_requests(ranks, MPI_REQUEST_NULL);
 
-		if (mpi_rank > 0) {
-			std::vector<T_key> keys;
-			std::vector<T_output> values;
+		auto outstanding = 0;
 
-			for (auto [key, value] : mr) {
-				keys.emplace_back(key);
-				values.emplace_back(value);
+		for (auto i = 0; i < ranks; i++) {
+			if (i == rank) {
+				continue;
 			}
 
-			mpi_send_global(&size, 1, 0);
+			if (send_counts[i] > 0) {
+				send_requests.emplace_back();
+				mpi_isend_global<char, 1>(send_buffers[i].data(), send_counts[i], i, &send_requests.back());
+			}
 
-			mpi_send_global(keys, 0);
-			mpi_send_global(values, 0);
+			if (receive_counts[i] > 0) {
+				receive_buffers[i].resize(receive_counts[i]);
 
-			mr.clear();
+				mpi_ireceive_global<char, 1>(receive_buffers[i].data(), receive_counts[i], i, &receive_requests[i]);
+				outstanding++;
+			}
+		}
 
-			return;
+		if (split_hot_keys) {
+			QueueReduces(values, partials);
 		}
 
-		std::map<T_key, std::vector<T_output>> intermediate_map{};
+		std::vector<value_block> received_blocks(ranks);
 
-		for (auto [key, val] : mr) {
-			intermediate_map[key] = { val };
-		}
+		for (; outstanding > 0; outstanding--) {
+			int node = MPI_UNDEFINED;
+
+			Scheduler::Instance().WaitUntil([&receive_requests, &node]() { return mpi_test_any(receive_requests, &node); });
 
-		for (auto i = 1; i < mpi_nodes; i++) {
-			size_t count;
+			auto& received = received_blocks[node];
 
-			mpi_receive_global(&count, 1, i);
+			const char* in = receive_buffers[node].data();
+			const char* end = in + receive_buffers[node].size();
 
-			auto keys = new T_key[count];
-			auto vals = new T_output[count];
+			while (in < end) {
+				T_key key{};
+				std::vector<T_output> vec{};
 
-			mpi_receive_global(keys, count, i);
-			mpi_receive_global(vals, count, i);
+				mpi_unpack(in, key);
+				mpi_unpack(in, vec);
 
-			for (auto j = 0; j < count; j++) {
-				auto& tmp_vec = intermediate_map[keys[j]];
-				tmp_vec.emplace_back(vals[j]);
+				// A peer sends every key once and in map order.
+				received.emplace_hint(received.end(), std::move(key), std::move(vec));
 			}
+
+			receive_buffers[node] = std::vector<char>{};
+
+			if (split_hot_keys) {
+				QueueReduces(received, partials);
+			}
+		}
+
+		if (!split_hot_keys) {
+			received_blocks[rank] = std::move(values);
+
+			auto gathered = Gather(received_blocks);
+			QueueReduces(gathered, partials);
+
+			values.clear();
 		}
 
-		mr.clear();
+		mpi_wait_all(send_requests);
+	}
+
+	MapReduceGlobalH(PatIntPtr<T_input, map_result> mapper_task, PatIntPtr<std::vector<T_output>, T_output> reducer_task, size_t threads, size_t mpi_nodes,
+		AlgoIntPtr<T_key, int> distributer, AlgoIntPtr<std::tuple<T_output, T_output>, T_output> combiner, size_t memory_budget,
+		ShuffleMode shuffle_mode, bool split_hot_keys)
+		: thread_count(threads), mapper(mapper_task), reducer(reducer_task), distributer(distributer),
+		partitioner(std::dynamic_pointer_cast<Partitioner<T_key>>(distributer)), combiner(combiner), memory_budget(memory_budget),
+		shuffle_mode(shuffle_mode), split_hot_keys(split_hot_keys), mpi_nodes(mpi_nodes), slots(threads) {
+	}
 
-		for (auto [key, vals] : intermediate_map) {
-			auto res = reducer.Compute(std::move(vals));
-			mr[key] = res;
+	void ReduceAtEnd(end_result& mr) {
+		if (mpi_nodes < 2) {
+			return;
 		}
+
+		mpi_tree_reduce_map(mr, static_cast<int>(mpi_nodes), [this](end_result& mine, end_result& received) {
+			MergeResults(mine, received);
+		});
 	}
 
 
 protected:
 	void InternallyCompute(std::future<FutVec<T_input>> future, std::promise<end_result> promise) override {
-		std::vector<std::future<T_input>> inputs = future.get();
+		std::vector<std::future<T_input>> inputs = await_future(future);
 		std::vector<std::future<void>> shuffle_await_vector{};
 
-		ThreadSafeKeyedCollection<T_key, T_output> tskc{};
+		ThreadSafeKeyedCollection<T_key, T_output> tskc(default_shard_count, memory_budget);
+
+		std::unique_ptr<SortedKeyedCollection<T_key, T_output>> sorting{};
+
+		if (shuffle_mode == ShuffleMode::Sorted) {
+			sorting = std::make_unique<SortedKeyedCollection<T_key, T_output>>();
+		}
+
+		std::unique_ptr<ShuffleCombiner<T_key, T_output>> combining{};
+
+		if (combiner) {
+			combining = std::make_unique<ShuffleCombiner<T_key, T_output>>(combiner);
+		}
 
 		for (std::future<T_input>& input : inputs) {
 			std::promise<void> prom_void;
 			shuffle_await_vector.emplace_back(prom_void.get_future());
 
 			std::promise<map_result> prom_res;
-			auto tup_shuffle = std::make_tuple(prom_res.get_future(), &tskc, std::move(prom_void));
+			auto tup_shuffle = std::make_tuple(prom_res.get_future(), &tskc, sorting.get(), combining.get(), std::move(prom_void));
 			auto tup_map = std::make_tuple(std::move(input), std::move(prom_res));
 
 			map_queue.push(std::move(tup_map));
 			shuffle_queue.push(std::move(tup_shuffle));
+
+			Notify();
 		}
 
 		for (auto& fut : shuffle_await_vector) {
-			fut.get();
+			await_future(fut);
 		}
 
-		std::map<T_key, std::vector<T_output>> shuffled_values{};
-		tskc.get(shuffled_values);
-
-		ShuffleNodes(shuffled_values);
-
-		std::map<T_key, std::future<T_output>> holding_map{};
-
-		for (auto [key, vals] : shuffled_values) {
-			std::promise<std::vector<T_output>> prom;
-
-			prom.set_value(std::move(vals));
+		if (combining && sorting) {
+			combining->flush(*sorting);
+		}
+		else if (combining) {
+			combining->flush(tskc);
+		}
 
-			std::promise<T_output> res_prom;
-			std::future<T_output> res_fut = res_prom.get_future();
+		std::vector<std::future<end_result>> partials{};
+		end_result end_result{};
 
-			auto tup_red = std::make_tuple(prom.get_future(), std::move(res_prom));
-			reduce_queue.push(std::move(tup_red));
+		auto collect_partials = [this, &partials, &end_result]() {
+			for (auto& partial : partials) {
+				auto block = await_future(partial);
+				MergeResults(end_result, block);
+			}
 
-			holding_map[key] = std::move(res_fut);
+			partials.clear();
+		};
+
+		// With a memory budget every shard is shuffled and reduced on its own, so only one
+		// shard is loaded back at a time. All ranks have the same budget and shard count and
+		// thereby go through the same shuffle rounds, whether or not they spilled.
+		if (memory_budget != 0) {
+			tskc.consume([this, &partials, &collect_partials](value_block& values) {
+				ShuffleNodes(values, partials);
+				collect_partials();
+			});
 		}
+		else {
+			value_block shuffled_values{};
 
-		end_result end_result{};
+			if (sorting) {
+				sorting->get(shuffled_values);
+			}
+			else {
+				tskc.get(shuffled_values);
+			}
 
-		for (auto& [key, vals] : holding_map) {
-			end_result[key] = holding_map[key].get();
+			ShuffleNodes(shuffled_values, partials);
 		}
 
+		collect_partials();
+
 		ReduceAtEnd(end_result);
 
 		promise.set_value(std::move(end_result));
 	}
 
 public:
+	// The optional combiner (e.g. ReduceAdd) merges values of the same key before the shuffle,
+	// it is only applied if the map values already have the output type. A memory budget
+	// other than 0 lets the shuffled values spill to disk beyond that many bytes and sends
+	// them to the other ranks one shard at a time, this is only supported by the hashed
+	// shuffle. split_hot_keys spreads the values of a key over several
+	// reduce tasks and reduces the values of every rank as soon as they arrive, which is only
+	// correct for an associative reducer.
 	static PatIntPtr<FutVec<T_input>, end_result> create(
 		PatIntPtr<T_input, map_result> mapper_task, PatIntPtr<std::vector<T_output>, T_output> reducer_task, size_t threads, size_t mpi_nodes,
-		AlgoIntPtr<T_key, int> distributer) {
+		AlgoIntPtr<T_key, int> distributer, AlgoIntPtr<std::tuple<T_output, T_output>, T_output> combiner = nullptr, size_t memory_budget = 0,
+		ShuffleMode shuffle_mode = ShuffleMode::Hashed, bool split_hot_keys = false) {
 		assert(threads > 0 && mpi_nodes > 0);
+		assert((memory_budget == 0 || shuffle_mode == ShuffleMode::Hashed) && "Only the hashed shuffle can spill");
 
-		auto mr = new MapReduceGlobalH(mapper_task, reducer_task, threads, mpi_nodes, distributer);
+		auto mr = new MapReduceGlobalH(mapper_task, reducer_task, threads, mpi_nodes, distributer, combiner, memory_budget, shuffle_mode, split_hot_keys);
 		auto s_ptr = PatIntPtr<FutVec<T_input>, end_result>(mr);
 		return s_ptr;
 	}
@@ -428,21 +1176,20 @@ public:
 	PatIntPtr<FutVec<T_input>, end_result> create_copy() override {
 		this->assertNoInit();
 
-		auto copy = create(mapper.GetTask(), reducer.GetTask(), threads.size(), mpi_nodes, distributer);
+		auto copy = create(mapper.GetTask(), reducer.GetTask(), thread_count, mpi_nodes, distributer, combiner, memory_budget, shuffle_mode, split_hot_keys);
 		return copy;
 	}
 
 	void Init() override {
 		if (!this->initialized) {
+			assert((!partitioner || partitioner->Nodes() == static_cast<int>(mpi_nodes))
+				&& "The partitioner has to assign keys to as many nodes as the pattern runs on");
+
 			this->dying = false;
 
 			mapper.Init();
 			reducer.Init();
 
-			for (unsigned i = 0; i < threads.size(); i++) {
-				threads[i] = std::thread(&MapReduceGlobalH::Perform, this);
-			}
-
 			this->initialized = true;
 		}
 	}
@@ -451,11 +1198,7 @@ public:
 		if (this->initialized) {
 			this->dying = true;
 
-			for (std::thread& thread : threads) {
-				if (thread.joinable()) {
-					thread.join();
-				}
-			}
+			tasks.Wait();
 
 			mapper.Dispose();
 			reducer.Dispose();
@@ -465,11 +1208,11 @@ public:
 	}
 
 	size_t ThreadCount() const noexcept override {
-		return threads.size() + (mapper.ThreadCount() + reducer.ThreadCount());;
+		return thread_count + (mapper.ThreadCount() + reducer.ThreadCount());;
 	}
 
 	std::string Name() const override {
-		return std::string("MapReduceGlobalH(") + mapper.Name() + "," + reducer.Name() + "," + std::to_string(threads.size()) + "," + std::to_string(mpi_nodes) + ")";
+		return std::string("MapReduceGlobalH(") + mapper.Name() + "," + reducer.Name() + "," + std::to_string(thread_count) + "," + std::to_string(mpi_nodes) + ")";
 	}
 
 	~MapReduceGlobalH() {
@@ -484,17 +1227,24 @@ class MapReduceLocalH : public PatternInterface<FutVec<T_input>, std::map<T_key,
 	typedef std::map<T_key, T_map_result> map_result;
 	typedef std::map<T_key, T_output> end_result;
 
-	std::vector<std::thread> threads{};
+	size_t thread_count{};
 
 	Executor<T_input, map_result> mapper{};
 	Executor<std::vector<T_output>, T_output> reducer{};
 
+	AlgoIntPtr<std::tuple<T_output, T_output>, T_output> combiner{};
+	size_t memory_budget{};
+	ShuffleMode shuffle_mode{};
+
 	TSQueue<std::tuple<std::future<T_input>, std::promise<map_result>>> map_queue{};
-	TSQueue<std::tuple<std::future<map_result>, ThreadSafeKeyedCollection<T_key, T_output>*, std::promise<void>>> shuffle_queue{};
+	TSQueue<std::tuple<std::future<map_result>, ThreadSafeKeyedCollection<T_key, T_output>*, SortedKeyedCollection<T_key, T_output>*, ShuffleCombiner<T_key, T_output>*, std::promise<void>>> shuffle_queue{};
 	TSQueue<std::tuple<std::future<std::vector<T_output>>, std::promise<T_output>>> reduce_queue{};
 
 	size_t mpi_nodes{};
 
+	WorkerSlots slots;
+	TaskGroup tasks{};
+
 	bool PerformMapFunction() {
 		std::tuple<std::future<T_input>, std::promise<map_result>> tuple;
 
@@ -513,7 +1263,7 @@ class MapReduceLocalH : public PatternInterface<FutVec<T_input>, std::map<T_key,
 	}
 
 	bool PerformShuffleFunction() {
-		std::tuple<std::future<map_result>, ThreadSafeKeyedCollection<T_key, T_output>*, std::promise<void>> tuple_queue{};
+		std::tuple<std::future<map_result>, ThreadSafeKeyedCollection<T_key, T_output>*, SortedKeyedCollection<T_key, T_output>*, ShuffleCombiner<T_key, T_output>*, std::promise<void>> tuple_queue{};
 
 		auto success = shuffle_queue.try_pop(tuple_queue);
 
@@ -523,12 +1273,33 @@ class MapReduceLocalH : public PatternInterface<FutVec<T_input>, std::map<T_key,
 
 		auto future = std::move(std::get<0>(tuple_queue));
 		auto tskc = std::move(std::get<1>(tuple_queue));
-		auto promise = std::move(std::get<2>(tuple_queue));
+		auto sorting = std::move(std::get<2>(tuple_queue));
+		auto combining = std::move(std::get<3>(tuple_queue));
+		auto promise = std::move(std::get<4>(tuple_queue));
 
-		auto result = future.get();
+		auto result = await_future(future);
 
-		for (auto [key, value] : result) {
-			tskc->add(key, value);
+		if constexpr (std::is_same_v<T_map_result, T_output>) {
+			if (combining != nullptr) {
+				for (auto& [key, value] : result) {
+					combining->add(key, value);
+				}
+
+				promise.set_value();
+
+				return true;
+			}
+		}
+
+		if (sorting != nullptr) {
+			for (auto& [key, value] : result) {
+				sorting->add(key, value);
+			}
+		}
+		else {
+			for (auto& [key, value] : result) {
+				tskc->add(key, value);
+			}
 		}
 
 		promise.set_value();
@@ -553,161 +1324,154 @@ class MapReduceLocalH : public PatternInterface<FutVec<T_input>, std::map<T_key,
 		return true;
 	}
 
-	void Perform() {
-		while (!this->dying) {
-			bool success_map = PerformMapFunction();
-
-			if (success_map) {
-				continue;
-			}
-
-			bool success_shuffle = PerformShuffleFunction();
-
-			if (success_shuffle) {
-				continue;
-			}
-
-			bool success_reduce = PerformReduceFunction();
-
-			if (success_reduce) {
-				continue;
-			}
+	bool Perform() {
+		return PerformMapFunction() || PerformShuffleFunction() || PerformReduceFunction();
+	}
 
-			std::this_thread::yield();
-		}
+	void Notify() {
+		slots.Notify(tasks, [this]() { return Perform(); });
 	}
 
 
 	void ReduceAtEnd(end_result& mr) {
-		size_t size = mr.size();
-
 		if (mpi_nodes < 2) {
 			return;
 		}
 
-		int mpi_rank = -1;
-
-		mpi_get_global_rank(&mpi_rank);
+		mpi_tree_reduce_map(mr, static_cast<int>(mpi_nodes), [this](end_result& mine, end_result& received) {
+			for (auto& [key, value] : received) {
+				auto entry = mine.find(key);
 
-		if (mpi_rank > 0) {
-			std::vector<T_key> keys;
-			std::vector<T_output> values;
+				if (entry == mine.end()) {
+					mine.emplace(key, std::move(value));
+					continue;
+				}
 
-			for (auto [key, value] : mr) {
-				keys.emplace_back(key);
-				values.emplace_back(value);
+				entry->second = reducer.Compute(std::vector<T_output>{ std::move(entry->second), std::move(value) });
 			}
+		});
+	}
 
-			mpi_send_global(&size, 1, 0);
-
-			mpi_send_global(keys, 0);
-			mpi_send_global(values, 0);
-
-			mr.clear();
-
-			return;
-		}
-
-		std::map<T_key, std::vector<T_output>> intermediate_map;
 
-		for (auto [key, val] : mr) {
-			intermediate_map[key] = { val };
-		}
-
-		for (auto i = 1; i < mpi_nodes; i++) {
-			size_t count;
+	MapReduceLocalH(PatIntPtr<T_input, map_result> mapper_task, PatIntPtr<std::vector<T_output>, T_output> reducer_task, size_t threads, size_t mpi_nodes,
+		AlgoIntPtr<std::tuple<T_output, T_output>, T_output> combiner, size_t memory_budget,
+		ShuffleMode shuffle_mode)
+		: thread_count(threads), mapper(mapper_task), reducer(reducer_task), combiner(combiner), memory_budget(memory_budget), shuffle_mode(shuffle_mode),
+		mpi_nodes(mpi_nodes), slots(threads) {
+	}
 
-			mpi_receive_global(&count, 1, i);
+protected:
+	void InternallyCompute(std::future<FutVec<T_input>> future, std::promise<end_result> promise) override {
+		std::vector<std::future<T_input>> inputs = await_future(future);
+		std::vector<std::future<void>> shuffle_await_vector{};
 
-			auto keys = new T_key[count];
-			auto vals = new T_output[count];
+		ThreadSafeKeyedCollection<T_key, T_output> tskc(default_shard_count, memory_budget);
 
-			mpi_receive_global(keys, count, i);
-			mpi_receive_global(vals, count, i);
+		std::unique_ptr<SortedKeyedCollection<T_key, T_output>> sorting{};
 
-			for (auto j = 0; j < count; j++) {
-				auto& tmp_vec = intermediate_map[keys[j]];
-				tmp_vec.emplace_back(vals[j]);
-			}
+		if (shuffle_mode == ShuffleMode::Sorted) {
+			sorting = std::make_unique<SortedKeyedCollection<T_key, T_output>>();
 		}
 
-		mr.clear();
+		std::unique_ptr<ShuffleCombiner<T_key, T_output>> combining{};
 
-		for (auto [key, vals] : intermediate_map) {
-			auto res = reducer.Compute(std::move(vals));
-			mr[key] = res;
+		if (combiner) {
+			combining = std::make_unique<ShuffleCombiner<T_key, T_output>>(combiner);
 		}
-	}
-
-
-	MapReduceLocalH(PatIntPtr<T_input, map_result> mapper_task, PatIntPtr<std::vector<T_output>, T_output> reducer_task, size_t threads, size_t mpi_nodes)
-		: mapper(mapper_task), reducer(reducer_task), threads(threads), mpi_nodes(mpi_nodes) {
-	}
-
-protected:
-	void InternallyCompute(std::future<FutVec<T_input>> future, std::promise<end_result> promise) override {
-		std::vector<std::future<T_input>> inputs = future.get();
-		std::vector<std::future<void>> shuffle_await_vector{};
-
-		ThreadSafeKeyedCollection<T_key, T_output> tskc{};
 
 		for (std::future<T_input>& input : inputs) {
 			std::promise<void> prom_void;
 			shuffle_await_vector.emplace_back(prom_void.get_future());
 
 			std::promise<map_result> prom_res;
-			auto tup_shuffle = std::make_tuple(prom_res.get_future(), &tskc, std::move(prom_void));
+			auto tup_shuffle = std::make_tuple(prom_res.get_future(), &tskc, sorting.get(), combining.get(), std::move(prom_void));
 			auto tup_map = std::make_tuple(std::move(input), std::move(prom_res));
 
 			map_queue.push(std::move(tup_map));
 			shuffle_queue.push(std::move(tup_shuffle));
+
+			Notify();
 		}
 
 		for (auto& fut : shuffle_await_vector) {
-			fut.get();
+			await_future(fut);
 		}
 
-		std::vector<std::vector<T_output>>  shuffled_values{};
-		tskc.get(shuffled_values);
+		if (combining && sorting) {
+			combining->flush(*sorting);
+		}
+		else if (combining) {
+			combining->flush(tskc);
+		}
 
 		if (mpi_nodes > 1) {
 			mpi_sync_global();
 		}
 
+		end_result result{};
+
 		std::vector<std::tuple<std::future<T_output>, T_key>> reduce_results{};
 
-		for (T_key key = 0; key < pre_size; key++) {
-			auto val = shuffled_values[key];
-			std::promise<std::vector<T_output>> prom_reduce;
-			prom_reduce.set_value(std::move(val));
+		auto collect_results = [&reduce_results, &result]() {
+			for (auto& reduce_result : reduce_results) {
+				auto key = std::move(std::get<1>(reduce_result));
+				auto fut_output_val = std::move(std::get<0>(reduce_result));
+				auto output_val = await_future(fut_output_val);
 
-			std::promise<T_output> prom_result;
-			reduce_results.emplace_back(std::make_tuple(prom_result.get_future(), key));
+				result[key] = output_val;
+			}
 
-			reduce_queue.push(std::make_tuple(prom_reduce.get_future(), std::move(prom_result)));
-		}
+			reduce_results.clear();
+		};
 
-		end_result result{};
+		// After a spill the shards are reduced one after the other, so only one of them is
+		// loaded back at a time.
+		auto shard_by_shard = tskc.spilled();
+
+		auto reduce_values = [this, &reduce_results, &collect_results, shard_by_shard](std::map<T_key, std::vector<T_output>>& shuffled_values) {
+			for (auto& [key, val] : shuffled_values) {
+				std::promise<std::vector<T_output>> prom_reduce;
+				prom_reduce.set_value(std::move(val));
 
-		for (auto& reduce_result : reduce_results) {
-			auto key = std::move(std::get<1>(reduce_result));
-			auto fut_output_val = std::move(std::get<0>(reduce_result));
-			auto output_val = fut_output_val.get();
+				std::promise<T_output> prom_result;
+				reduce_results.emplace_back(std::make_tuple(prom_result.get_future(), key));
+
+				reduce_queue.push(std::make_tuple(prom_reduce.get_future(), std::move(prom_result)));
+				Notify();
+			}
 
-			result[key] = output_val;
+			if (shard_by_shard) {
+				collect_results();
+			}
+		};
+
+		if (sorting) {
+			sorting->consume(reduce_values);
+		}
+		else {
+			tskc.consume(reduce_values);
 		}
 
+		collect_results();
+
 		ReduceAtEnd(result);
 
 		promise.set_value(std::move(result));
 	}
 
 public:
+	// The optional combiner (e.g. ReduceAdd) merges values of the same key before the shuffle,
+	// it is only applied if the map values already have the output type. A memory budget
+	// other than 0 lets the shuffled values spill to disk beyond that many bytes, this is only
+	// supported by the hashed shuffle.
 	static PatIntPtr<FutVec<T_input>, end_result> create(
-		PatIntPtr<T_input, map_result> mapper_task, PatIntPtr<std::vector<T_output>, T_output> reducer_task, size_t threads, size_t mpi_nodes) {
+		PatIntPtr<T_input, map_result> mapper_task, PatIntPtr<std::vector<T_output>, T_output> reducer_task, size_t threads, size_t mpi_nodes,
+		AlgoIntPtr<std::tuple<T_output, T_output>, T_output> combiner = nullptr, size_t memory_budget = 0,
+		ShuffleMode shuffle_mode = ShuffleMode::Hashed) {
 		assert(threads > 0 && mpi_nodes > 0);
+		assert((memory_budget == 0 || shuffle_mode == ShuffleMode::Hashed) && "Only the hashed shuffle can spill");
 
-		auto mr = new MapReduceLocalH(mapper_task, reducer_task, threads, mpi_nodes);
+		auto mr = new MapReduceLocalH(mapper_task, reducer_task, threads, mpi_nodes, combiner, memory_budget, shuffle_mode);
 		auto s_ptr = PatIntPtr<FutVec<T_input>, end_result>(mr);
 		return s_ptr;
 	}
@@ -721,7 +1485,7 @@ public:
 	PatIntPtr<FutVec<T_input>, end_result> create_copy() override {
 		this->assertNoInit();
 
-		auto copy = create(mapper.GetTask(), reducer.GetTask(), threads.size(), mpi_nodes);
+		auto copy = create(mapper.GetTask(), reducer.GetTask(), thread_count, mpi_nodes, combiner, memory_budget, shuffle_mode);
 		return copy;
 	}
 
@@ -732,10 +1496,6 @@ public:
 			mapper.Init();
 			reducer.Init();
 
-			for (unsigned i = 0; i < threads.size(); i++) {
-				threads[i] = std::thread(&MapReduceLocalH::Perform, this);
-			}
-
 			this->initialized = true;
 		}
 	}
@@ -744,11 +1504,7 @@ public:
 		if (this->initialized) {
 			this->dying = true;
 
-			for (std::thread& thread : threads) {
-				if (thread.joinable()) {
-					thread.join();
-				}
-			}
+			tasks.Wait();
 
 			mapper.Dispose();
 			reducer.Dispose();
@@ -758,11 +1514,11 @@ public:
 	}
 
 	size_t ThreadCount() const noexcept override {
-		return threads.size() + (mapper.ThreadCount() + reducer.ThreadCount());;
+		return thread_count + (mapper.ThreadCount() + reducer.ThreadCount());;
 	}
 
 	std::string Name() const override {
-		return std::string("MapReduceLocalH(") + mapper.Name() + "," + reducer.Name() + "," + std::to_string(threads.size()) + "," + std::to_string(mpi_nodes) + ")";
+		return std::string("MapReduceLocalH(") + mapper.Name() + "," + reducer.Name() + "," + std::to_string(thread_count) + "," + std::to_string(mpi_nodes) + ")";
 	}
 
 	~MapReduceLocalH() {
@@ -776,18 +1532,57 @@ class MapReduceLocalV : public PatternInterface<FutVec<T_input>, std::map<T_key,
 
 	typedef std::map<T_key, T_output> map_result;
 
-	std::vector<std::thread> threads{};
+	// The partial maps of one computation. pending counts the maps that are ready or still
+	// being mapped or reduced, once it drops to one the remaining map is the result.
+	struct PartialMaps {
+		std::mutex mutex{};
+		std::vector<map_result> ready{};
+		size_t pending{};
+		std::promise<map_result> result{};
+	};
+
+	size_t thread_count{};
 
 	Executor<T_input, map_result> mapper{};
 	Executor<std::tuple<map_result, map_result>, map_result> reducer{};
 
-	TSQueue<std::tuple<std::future<T_input>, std::promise<map_result>>> map_queue{};
-	TSQueue<std::tuple<map_result, map_result, std::promise<map_result>>> reduce_queue{};
+	TSQueue<std::tuple<std::future<T_input>, std::shared_ptr<PartialMaps>>> map_queue{};
+	TSQueue<std::tuple<map_result, map_result, std::shared_ptr<PartialMaps>>> reduce_queue{};
 
 	size_t mpi_nodes{};
 
+	WorkerSlots slots;
+	TaskGroup tasks{};
+
+	// Pairs a finished map with any other ready one, so the reduce tree follows the order in
+	// which the maps complete instead of their index. This requires the reducer to be
+	// commutative as well as associative.
+	void Offer(const std::shared_ptr<PartialMaps>& partials, map_result&& map) {
+		std::unique_lock<std::mutex> lock(partials->mutex);
+
+		if (partials->pending == 1) {
+			lock.unlock();
+			partials->result.set_value(std::move(map));
+			return;
+		}
+
+		if (partials->ready.empty()) {
+			partials->ready.emplace_back(std::move(map));
+			return;
+		}
+
+		auto other = std::move(partials->ready.back());
+		partials->ready.pop_back();
+		partials->pending--;
+
+		lock.unlock();
+
+		reduce_queue.push(std::make_tuple(std::move(other), std::move(map), partials));
+		Notify();
+	}
+
 	bool PerformMapFunction() {
-		std::tuple<std::future<T_input>, std::promise<map_result>> tuple{};
+		std::tuple<std::future<T_input>, std::shared_ptr<PartialMaps>> tuple{};
 
 		auto success = map_queue.try_pop(tuple);
 
@@ -796,15 +1591,20 @@ class MapReduceLocalV : public PatternInterface<FutVec<T_input>, std::map<T_key,
 		}
 
 		auto future = std::move(std::get<0>(tuple));
-		auto promise = std::move(std::get<1>(tuple));
+		auto partials = std::move(std::get<1>(tuple));
 
-		mapper.Compute(std::move(future), std::move(promise));
+		std::promise<map_result> prom{};
+		auto fut = prom.get_future();
+
+		mapper.Compute(std::move(future), std::move(prom));
+
+		Offer(partials, await_future(fut));
 
 		return true;
 	}
 
 	bool PerformReduceFunction() {
-		std::tuple<map_result, map_result, std::promise<map_result>> tuple_queue{};
+		std::tuple<map_result, map_result, std::shared_ptr<PartialMaps>> tuple_queue{};
 
 		auto success = reduce_queue.try_pop(tuple_queue);
 
@@ -814,7 +1614,7 @@ class MapReduceLocalV : public PatternInterface<FutVec<T_input>, std::map<T_key,
 
 		auto future_1 = std::move(std::get<0>(tuple_queue));
 		auto future_2 = std::move(std::get<1>(tuple_queue));
-		auto prom = std::move(std::get<2>(tuple_queue));
+		auto partials = std::move(std::get<2>(tuple_queue));
 
 		auto tup = std::make_tuple(std::move(future_1), std::move(future_2));
 
@@ -823,142 +1623,114 @@ class MapReduceLocalV : public PatternInterface<FutVec<T_input>, std::map<T_key,
 
 		auto tf = p.get_future();
 
+		std::promise<map_result> prom{};
+		auto fut = prom.get_future();
+
 		reducer.Compute(std::move(tf), std::move(prom));
 
+		Offer(partials, await_future(fut));
+
 		return true;
 	}
 
-	void Perform() {
-		while (!this->dying) {
-			bool success_map = PerformMapFunction();
-
-			if (success_map) {
-				continue;
-			}
-
-			bool success_reduce = PerformReduceFunction();
-
-			if (success_reduce) {
-				continue;
-			}
+	bool Perform() {
+		return PerformMapFunction() || PerformReduceFunction();
+	}
 
-			std::this_thread::yield();
-		}
+	void Notify() {
+		slots.Notify(tasks, [this]() { return Perform(); });
 	}
 
 
+	// Same tree as mpi_tree_reduce_map, but the maps of the children are offered to the reduce
+	// queue in the order they arrive, so a rank with several children reduces them on all of
+	// its workers. Only the calling thread receives unless MPI runs with MPI_THREAD_MULTIPLE,
+	// then the workers also receive and unpack the maps concurrently.
 	void ReduceAtEnd(map_result& mr) {
-		size_t size = mr.size();
-
 		if (mpi_nodes < 2) {
 			return;
 		}
 
-		int mpi_rank = -1;
-		mpi_get_global_rank(&mpi_rank);
+		const auto rank = mpi_get_global_rank();
+		const auto nodes = static_cast<int>(mpi_nodes);
 
-		if (mpi_rank > 0) {
-			std::vector<T_key> keys{};
-			std::vector<T_output> values{};
-
-			for (auto [key, value] : mr) {
-				keys.emplace_back(key);
-				values.emplace_back(value);
-			}
-
-			mpi_send_size(0, size);
+		if (rank >= nodes) {
+			return;
+		}
 
-			mpi_send_global(keys, 0);
-			mpi_send_global(values, 0);
+		auto children = mpi_tree_children(rank, nodes);
 
-			mr.clear();
+		if (!children.empty()) {
+			auto partials = std::make_shared<PartialMaps>();
+			partials->pending = children.size() + 1;
 
-			return;
-		}
+			auto result_future = partials->result.get_future();
 
-		std::vector<map_result> intermediate_results(mpi_nodes);
-		intermediate_results[0] = std::move(mr);
+			Offer(partials, std::move(mr));
 
-		for (auto i = 1; i < mpi_nodes; i++) {
-			size_t count = mpi_receive_size(i);
+			const auto receive_on_workers = mpi_thread_multiple();
 
-			auto keys = new T_key[count];
-			auto vals = new T_output[count];
+			while (!children.empty()) {
+				auto child = children.begin();
 
-			mpi_receive_global(keys, count, i);
-			mpi_receive_global(vals, count, i);
+				Scheduler::Instance().WaitUntil([&children, &child]() {
+					child = std::find_if(children.begin(), children.end(), [](int node) { return mpi_probe_global<mpi_tree_tag>(node); });
+					return child != children.end();
+				});
 
-			map_result tmp_map{};
+				auto node = *child;
+				children.erase(child);
 
-			for (auto j = 0; j < count; j++) {
-				auto& key = keys[j];
-				auto& val = vals[j];
-				tmp_map[key] = val;
+				if (receive_on_workers) {
+					tasks.Run([this, partials, node]() {
+						Offer(partials, mpi_receive_object<map_result, mpi_tree_tag>(node));
+					});
+				}
+				else {
+					tasks.Run([this, partials, buffer = mpi_receive_packed<mpi_tree_tag>(node)]() {
+						Offer(partials, mpi_unpack_object<map_result>(buffer));
+					});
+				}
 			}
 
-			intermediate_results[i] = std::move(tmp_map);
+			mr = await_future(result_future);
 		}
 
-		auto int_size = intermediate_results.size();
-		auto int_idx = 0;
-
-		for (auto i = 0; i < int_size - 1; i++) {
-			auto first_index = int_idx++;
-			auto second_index = int_idx++;
+		auto parent = mpi_tree_parent(rank);
 
-			auto& first = intermediate_results[first_index];
-			auto& second = intermediate_results[second_index];
-
-			auto res = reducer.Compute(std::make_tuple(std::move(first), std::move(second)));
-			intermediate_results.emplace_back(std::move(res));
+		if (parent >= 0) {
+			mpi_send_object<map_result, mpi_tree_tag>(mr, parent);
+			mr.clear();
 		}
-
-		mr = std::move(intermediate_results[intermediate_results.size() - 1]);
 	}
 
 
 	MapReduceLocalV(PatIntPtr<T_input, map_result> mapper_task, PatIntPtr<std::tuple<map_result, map_result>, map_result> reducer_task, size_t threads, size_t mpi_nodes)
-		: mapper(mapper_task), reducer(reducer_task), threads(threads), mpi_nodes(mpi_nodes) {
+		: thread_count(threads), mapper(mapper_task), reducer(reducer_task), mpi_nodes(mpi_nodes), slots(threads) {
 	}
 
 protected:
 	void InternallyCompute(std::future<FutVec<T_input>> future, std::promise<map_result> promise) override {
-		FutVec<T_input> inputs = future.get();
+		FutVec<T_input> inputs = await_future(future);
 
-		FutVec<map_result> outputs{};
+		auto partials = std::make_shared<PartialMaps>();
+		partials->pending = inputs.size();
 
-		for (std::future<T_input>& input : inputs) {
-			std::promise<map_result> prom{};
-			auto fut = prom.get_future();
-			auto tup_map = std::make_tuple(std::move(input), std::move(prom));
+		auto result_future = partials->result.get_future();
 
-			map_queue.push(std::move(tup_map));
-			outputs.emplace_back(std::move(fut));
+		if (inputs.empty()) {
+			partials->result.set_value(map_result{});
 		}
 
-		auto idx = 0;
-
-		for (auto i = 0; i < inputs.size() - 1; i++) {
-			auto first_index = idx++;
-			auto second_index = idx++;
-
-			auto& first_f = outputs[first_index];
-			auto& second_f = outputs[second_index];
-
-			auto first_r = first_f.get();
-			auto second_r = second_f.get();
-
-			std::promise<map_result> p{};
-			std::future<map_result> fut = p.get_future();
+		for (std::future<T_input>& input : inputs) {
+			auto tup_map = std::make_tuple(std::move(input), partials);
 
-			outputs.emplace_back(std::move(fut));
+			map_queue.push(std::move(tup_map));
 
-			auto tup = std::make_tuple(std::move(first_r), std::move(second_r), std::move(p));
-			reduce_queue.push(std::move(tup));
+			Notify();
 		}
 
-		auto& last = outputs[outputs.size() - 1];
-		map_result result = last.get();
+		map_result result = await_future(result_future);
 
 		ReduceAtEnd(result);
 
@@ -984,7 +1756,7 @@ public:
 	PatIntPtr<FutVec<T_input>, map_result> create_copy() override {
 		this->assertNoInit();
 
-		auto copy = create(mapper.GetTask(), reducer.GetTask(), threads.size(), mpi_nodes);
+		auto copy = create(mapper.GetTask(), reducer.GetTask(), thread_count, mpi_nodes);
 		return copy;
 	}
 
@@ -995,10 +1767,6 @@ public:
 			mapper.Init();
 			reducer.Init();
 
-			for (unsigned i = 0; i < threads.size(); i++) {
-				threads[i] = std::thread(&MapReduceLocalV::Perform, this);
-			}
-
 			this->initialized = true;
 		}
 	}
@@ -1007,11 +1775,7 @@ public:
 		if (this->initialized) {
 			this->dying = true;
 
-			for (std::thread& thread : threads) {
-				if (thread.joinable()) {
-					thread.join();
-				}
-			}
+			tasks.Wait();
 
 			mapper.Dispose();
 			reducer.Dispose();
@@ -1021,11 +1785,11 @@ public:
 	}
 
 	size_t ThreadCount() const noexcept override {
-		return threads.size() + (mapper.ThreadCount() + reducer.ThreadCount());;
+		return thread_count + (mapper.ThreadCount() + reducer.ThreadCount());;
 	}
 
 	std::string Name() const override {
-		return std::string("MapReduceLocalV(") + mapper.Name() + "," + reducer.Name() + "," + std::to_string(threads.size()) + "," + std::to_string(mpi_nodes) + ")";
+		return std::string("MapReduceLocalV(") + mapper.Name() + "," + reducer.Name() + "," + std::to_string(thread_count) + "," + std::to_string(mpi_nodes) + ")";
 	}
 
 	~MapReduceLocalV() {
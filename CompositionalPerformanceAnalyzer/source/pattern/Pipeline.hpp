@@ -2,79 +2,297 @@
 
 #include "../Commons.hpp"
 #include "../interfaces/PatternInterface.hpp"
-#include "../interfaces/ThreadSafeQueue.hpp"
+#include "../interfaces/AsyncQueue.hpp"
 #include "../interfaces/Executor.hpp"
+#include "../interfaces/Future.hpp"
+#include "../interfaces/Scheduler.hpp"
+#include "../interfaces/Task.hpp"
 
+#include <array>
+#include <cassert>
+#include <exception>
 #include <future>
-#include <thread>
-
-template<typename T_input, typename T_intermediate, typename T_output>
-class Pipeline : public PatternInterface<T_input, T_output> {
-	Executor<T_input, T_intermediate> executor1{};
-	Executor<T_intermediate, T_output> executor2{};
-
-	std::thread stage1_thread{};
-	std::thread stage2_thread{};
-
-	TSQueue<std::tuple<std::future<T_input>, std::promise<T_intermediate>>> first_queue{};
-	TSQueue<std::tuple<std::future<T_intermediate>, std::promise<T_output>>> second_queue{};
-
-	void PerformFirstStage() {
-		while (!this->dying) {
-			std::tuple<std::future<T_input>, std::promise<T_intermediate>> data{};
-			bool success = this->first_queue.try_pop(data);
-
-			if (!success) {
-				if (this->dying) {
-					break;
-				}
-				std::this_thread::yield();
-				continue;
+#include <memory>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+template<typename T_input, typename T_output>
+class PipelineStage {
+public:
+	Executor<T_input, T_output> executor;
+
+	// Holds the inputs of this stage once the previous stage has produced them, so the
+	// workers of a stage never wait for the stage before it.
+	AsyncQueue<T_input, T_output> queue;
+
+	WorkerSlots slots;
+
+	PipelineStage(PatIntPtr<T_input, T_output> pattern, size_t workers, size_t high_water_mark)
+		: executor(pattern, workers), queue(high_water_mark), slots(workers) { }
+
+	PipelineStage(const PipelineStage& other) = delete;
+	PipelineStage(PipelineStage&& other) = delete;
+
+	PipelineStage& operator=(const PipelineStage& other) = delete;
+	PipelineStage& operator=(PipelineStage&& other) = delete;
+
+	bool Perform() {
+		queue.Admit();
+		return queue.Perform(executor) || queue.PerformBatch(executor);
+	}
+
+	void Notify(TaskGroup& tasks) {
+		slots.Notify(tasks, [this]() { return Perform(); });
+	}
+
+	size_t ThreadCount() const noexcept {
+		return slots.Limit() * executor.ThreadCount();
+	}
+};
+
+// Chains any number of stages, Pipeline<T0, T1, ..., Tn> runs n stages with one queue per
+// boundary. Each stage drains its queue with its own number of workers (default one),
+// so a long pipeline no longer needs a nested Pipeline for every additional stage.
+// Every input reserves a slot at all stages when it is admitted, so a high-water mark on a
+// stage bounds the inputs that have not yet been picked up by that stage.
+template<typename... T_types>
+class Pipeline : public PatternInterface<
+	std::tuple_element_t<0, std::tuple<T_types...>>,
+	std::tuple_element_t<sizeof...(T_types) - 1, std::tuple<T_types...>>> {
+	static_assert(sizeof...(T_types) >= 3, "A pipeline needs at least two stages");
+
+	using Types = std::tuple<T_types...>;
+
+	using T_input = std::tuple_element_t<0, Types>;
+	using T_output = std::tuple_element_t<sizeof...(T_types) - 1, Types>;
+
+	template<size_t I>
+	using StageInput = std::tuple_element_t<I, Types>;
+
+	template<size_t I>
+	using StageOutput = std::tuple_element_t<I + 1, Types>;
+
+	template<size_t I>
+	using Stage = PipelineStage<StageInput<I>, StageOutput<I>>;
+
+	template<typename T_sequence>
+	struct StageTypes;
+
+	template<size_t... Is>
+	struct StageTypes<std::index_sequence<Is...>> {
+		using Patterns = std::tuple<PatIntPtr<StageInput<Is>, StageOutput<Is>>...>;
+		using Stages = std::tuple<std::unique_ptr<Stage<Is>>...>;
+	};
+
+public:
+	static constexpr const size_t stage_count = sizeof...(T_types) - 1;
+
+	using Workers = std::array<size_t, stage_count>;
+	using HighWaterMarks = std::array<size_t, stage_count>;
+
+private:
+	using StageSequence = std::make_index_sequence<stage_count>;
+	using Patterns = typename StageTypes<StageSequence>::Patterns;
+	using Stages = typename StageTypes<StageSequence>::Stages;
+
+	Stages stages{};
+	Workers workers{};
+	HighWaterMarks high_water_marks{};
+
+	TaskGroup tasks{};
+
+	template<size_t... Is>
+	Pipeline(const Workers& workers, const HighWaterMarks& high_water_marks, Patterns& patterns, std::index_sequence<Is...>)
+		: stages(std::make_unique<Stage<Is>>(std::get<Is>(patterns), workers[Is], high_water_marks[Is])...),
+		workers(workers), high_water_marks(high_water_marks) { }
+
+	template<size_t I>
+	bool TryReserve() {
+		if constexpr (I == stage_count) {
+			return true;
+		}
+		else {
+			auto& queue = std::get<I>(stages)->queue;
+
+			if (!queue.TryReserve()) {
+				return false;
 			}
 
-			auto future = std::move(std::get<0>(data));
-			auto promise = std::move(std::get<1>(data));
+			if (!TryReserve<I + 1>()) {
+				queue.Release();
+				return false;
+			}
 
-			executor1.Compute(std::move(future), std::move(promise));
+			return true;
 		}
 	}
 
-	void PerformSecondStage() {
-		while (!this->dying) {
-			std::tuple<std::future<T_intermediate>, std::promise<T_output>> data{};
-			bool success = this->second_queue.try_pop(data);
+	// Every stage chains on the output Future of the stage before it. The slots were reserved
+	// at all stages when the input was admitted.
+	template<size_t I>
+	Future<T_output> EnqueueReserved(Future<StageInput<I>> input) {
+		auto& stage = *std::get<I>(stages);
+		auto output = stage.queue.PushReserved(std::move(input), [this, &stage]() { stage.Notify(tasks); });
 
-			if (!success) {
-				if (this->dying) {
-					break;
-				}
-				std::this_thread::yield();
-				continue;
-			}
+		if constexpr (I + 1 == stage_count) {
+			return output;
+		}
+		else {
+			return EnqueueReserved<I + 1>(std::move(output));
+		}
+	}
+
+	template<size_t I>
+	Future<std::vector<T_output>> EnqueueBatchReserved(Future<std::vector<StageInput<I>>> input) {
+		auto& stage = *std::get<I>(stages);
+		auto output = stage.queue.PushBatchReserved(std::move(input), [this, &stage]() { stage.Notify(tasks); });
+
+		if constexpr (I + 1 == stage_count) {
+			return output;
+		}
+		else {
+			return EnqueueBatchReserved<I + 1>(std::move(output));
+		}
+	}
+
+	// ComputeAsync admits an input per stage, when the previous stage has produced it.
+	template<size_t I>
+	Future<T_output> ChainAsync(Future<StageInput<I>> input) {
+		auto& stage = *std::get<I>(stages);
+		auto output = stage.queue.Push(std::move(input), [this, &stage]() { stage.Notify(tasks); });
 
-			auto future = std::move(std::get<0>(data));
-			auto promise = std::move(std::get<1>(data));
+		if constexpr (I + 1 == stage_count) {
+			return output;
+		}
+		else {
+			return ChainAsync<I + 1>(std::move(output));
+		}
+	}
 
-			executor2.Compute(std::move(future), std::move(promise));
+	template<size_t I>
+	Future<std::vector<T_output>> ChainBatchAsync(Future<std::vector<StageInput<I>>> input) {
+		auto& stage = *std::get<I>(stages);
+		auto output = stage.queue.PushBatch(std::move(input), [this, &stage]() { stage.Notify(tasks); });
+
+		if constexpr (I + 1 == stage_count) {
+			return output;
+		}
+		else {
+			return ChainBatchAsync<I + 1>(std::move(output));
 		}
 	}
 
-	Pipeline(PatIntPtr<T_input, T_intermediate> interface1, PatIntPtr<T_intermediate, T_output> interface2)
-		: executor1(interface1), executor2(interface2) { }
+#if defined(CPA_COROUTINES)
+	// Suspends on the queue of each stage in turn, between the stages the value lives in the
+	// coroutine frame instead of a worker.
+	template<size_t I>
+	Task<T_output> ChainTask(StageInput<I> input) {
+		auto& stage = *std::get<I>(stages);
+		auto output = co_await stage.queue.Push(make_ready_future(std::move(input)), [this, &stage]() { stage.Notify(tasks); });
+
+		if constexpr (I + 1 == stage_count) {
+			co_return output;
+		}
+		else {
+			co_return co_await ChainTask<I + 1>(std::move(output));
+		}
+	}
+#endif
+
+	template<size_t... Is>
+	PatIntPtr<T_input, T_output> CopyStages(std::index_sequence<Is...>) {
+		return create_bounded(workers, high_water_marks, std::get<Is>(stages)->executor.GetTask()...);
+	}
+
+	template<size_t... Is>
+	size_t StageThreadCount(std::index_sequence<Is...>) const noexcept {
+		return (std::get<Is>(stages)->ThreadCount() + ...);
+	}
+
+	template<size_t... Is>
+	std::string StageNames(std::index_sequence<Is...>) const {
+		std::string names{};
+		((names += (Is == 0 ? std::string() : std::string(",")) + std::get<Is>(stages)->executor.Name()), ...);
+		return names;
+	}
+
+	template<size_t... Is>
+	size_t WaitingInputs(std::index_sequence<Is...>) const noexcept {
+		return (std::get<Is>(stages)->queue.Waiting() + ...);
+	}
+
+	template<typename Function, size_t... Is>
+	void ForEachStage(Function function, std::index_sequence<Is...>) {
+		(function(*std::get<Is>(stages)), ...);
+	}
 
 protected:
 	void InternallyCompute(std::future<T_input> future, std::promise<T_output> promise) override {
-		std::promise<T_intermediate> intermediate_promise{};
-		std::future<T_intermediate> intermediate_future = intermediate_promise.get_future();
+		Scheduler::Instance().WaitUntil([this]() { return TryReserve<0>(); });
+		forward_to_promise(EnqueueReserved<0>(to_future(std::move(future))), std::move(promise));
+	}
+
+	bool InternallyTryCompute(std::future<T_input>& future, std::promise<T_output>& promise) override {
+		if (!TryReserve<0>()) {
+			return false;
+		}
 
-		first_queue.push(std::make_tuple(std::move(future), std::move(intermediate_promise)));
-		second_queue.push(std::make_tuple(std::move(intermediate_future), std::move(promise)));
+		forward_to_promise(EnqueueReserved<0>(to_future(std::move(future))), std::move(promise));
+		return true;
 	}
 
+	void InternallyComputeBatch(std::future<std::vector<T_input>> future, std::promise<std::vector<T_output>> promise) override {
+		Scheduler::Instance().WaitUntil([this]() { return TryReserve<0>(); });
+		forward_to_promise(EnqueueBatchReserved<0>(to_future(std::move(future))), std::move(promise));
+	}
+
+	Future<std::vector<T_output>> InternallyComputeBatchAsync(Future<std::vector<T_input>> input) override {
+		return ChainBatchAsync<0>(std::move(input));
+	}
+
+	// Goes through the queue and the workers of every stage like Compute().
+	Future<T_output> InternallyComputeAsync(Future<T_input> input) override {
+		return ChainAsync<0>(std::move(input));
+	}
+
+#if defined(CPA_COROUTINES)
+	Task<T_output> InternallyComputeTask(T_input input) override {
+		return ChainTask<0>(std::move(input));
+	}
+#endif
+
 public:
-	static PatIntPtr<T_input, T_output> create
-		(PatIntPtr<T_input, T_intermediate> interface1, PatIntPtr<T_intermediate, T_output> interface2) {
-		auto pipe = new Pipeline(interface1, interface2);
+	template<typename... T_patterns>
+	static PatIntPtr<T_input, T_output> create(T_patterns... patterns) {
+		Workers workers{};
+		workers.fill(1);
+
+		return create_with_workers(workers, std::move(patterns)...);
+	}
+
+	template<typename... T_patterns>
+	static PatIntPtr<T_input, T_output> create_with_workers(const Workers& workers, T_patterns... patterns) {
+		HighWaterMarks high_water_marks{};
+		high_water_marks.fill(0);
+
+		return create_bounded(workers, high_water_marks, std::move(patterns)...);
+	}
+
+	// A high-water mark of 0 leaves the queue of that stage unbounded.
+	template<typename... T_patterns>
+	static PatIntPtr<T_input, T_output> create_bounded
+		(const Workers& workers, const HighWaterMarks& high_water_marks, T_patterns... patterns) {
+		static_assert(sizeof...(T_patterns) == stage_count, "Need one pattern per stage");
+
+		for (auto count : workers) {
+			assert(count > 0 && "Every stage needs a worker");
+			((void)(count));
+		}
+
+		Patterns stage_patterns(std::move(patterns)...);
+
+		auto pipe = new Pipeline(workers, high_water_marks, stage_patterns, StageSequence{});
 		auto s_ptr = std::shared_ptr<PatternInterface<T_input, T_output>>(pipe);
 		return s_ptr;
 	}
@@ -88,27 +306,27 @@ public:
 	PatIntPtr<T_input, T_output> create_copy() override {
 		this->assertNoInit();
 
-		auto copied_version = create(executor1.GetTask(), executor2.GetTask());
+		auto copied_version = CopyStages(StageSequence{});
 		return copied_version;
 	}
 
+	size_t Backlog() const noexcept override {
+		return std::get<stage_count - 1>(stages)->queue.Occupied() + WaitingInputs(StageSequence{});
+	}
+
 	size_t ThreadCount() const noexcept override {
-		return executor1.ThreadCount() + executor2.ThreadCount() + 2;
+		return StageThreadCount(StageSequence{});
 	}
 
 	std::string Name() const override {
-		return std::string("pipeline(") + executor1.Name() + std::string(",") + executor2.Name() + std::string(")");
+		return std::string("pipeline(") + StageNames(StageSequence{}) + std::string(")");
 	}
 
 	void Init() override {
 		if (!this->initialized) {
 			this->dying = false;
 
-			executor1.Init();
-			executor2.Init();
-
-			stage1_thread = std::thread(&Pipeline::PerformFirstStage, this);
-			stage2_thread = std::thread(&Pipeline::PerformSecondStage, this);
+			ForEachStage([](auto& stage) { stage.executor.Init(); }, StageSequence{});
 
 			this->initialized = true;
 		}
@@ -118,17 +336,15 @@ public:
 		if (this->initialized) {
 			this->dying = true;
 
-			stage1_thread.join();
-			stage2_thread.join();
+			tasks.Wait();
 
-			executor1.Dispose();
-			executor2.Dispose();
+			ForEachStage([](auto& stage) { stage.executor.Dispose(); }, StageSequence{});
 
 			this->initialized = false;
 		}
 	}
 
 	~Pipeline() {
-		Pipeline<T_input, T_intermediate, T_output>::Dispose();
+		Pipeline<T_types...>::Dispose();
 	}
 };
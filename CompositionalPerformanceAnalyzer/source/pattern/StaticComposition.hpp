@@ -0,0 +1,151 @@
+#pragma once
+
+#include "../Commons.hpp"
+#include "../interfaces/AlgorithmInterface.hpp"
+#include "../interfaces/PatternInterface.hpp"
+#include "../interfaces/Future.hpp"
+#include "../interfaces/Task.hpp"
+#include "../interfaces/Scheduler.hpp"
+
+#include <exception>
+#include <future>
+#include <memory>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+template<typename T_input, typename T_output>
+AlgorithmInterface<T_input, T_output> algorithm_base(const AlgorithmInterface<T_input, T_output>&);
+
+template<typename T_algorithm>
+struct AlgorithmTypes;
+
+template<typename T_input, typename T_output>
+struct AlgorithmTypes<AlgorithmInterface<T_input, T_output>> {
+	using Input = T_input;
+	using Output = T_output;
+};
+
+template<typename T_algorithm>
+using AlgorithmInput = typename AlgorithmTypes<decltype(algorithm_base(std::declval<const T_algorithm&>()))>::Input;
+
+template<typename T_algorithm>
+using AlgorithmOutput = typename AlgorithmTypes<decltype(algorithm_base(std::declval<const T_algorithm&>()))>::Output;
+
+// Chains concrete algorithms that are known at compile time. The algorithms are held by value
+// and called non-virtually, so the compiler sees the whole chain as one function body and can
+// inline and vectorize across the stage boundaries.
+template<typename... T_algorithms>
+class StaticComposition : public PatternInterface<
+	AlgorithmInput<std::tuple_element_t<0, std::tuple<T_algorithms...>>>,
+	AlgorithmOutput<std::tuple_element_t<sizeof...(T_algorithms) - 1, std::tuple<T_algorithms...>>>> {
+	static_assert(sizeof...(T_algorithms) > 0, "A composition needs at least one algorithm");
+
+	using Algorithms = std::tuple<T_algorithms...>;
+
+	static constexpr const size_t algorithm_count = sizeof...(T_algorithms);
+
+	using T_input = AlgorithmInput<std::tuple_element_t<0, Algorithms>>;
+	using T_output = AlgorithmOutput<std::tuple_element_t<algorithm_count - 1, Algorithms>>;
+
+	Algorithms algorithms;
+
+	template<size_t I>
+	auto Apply(AlgorithmInput<std::tuple_element_t<I, Algorithms>>&& input) const {
+		using Algorithm = std::tuple_element_t<I, Algorithms>;
+
+		static_assert(I == 0 || std::is_same_v<AlgorithmInput<Algorithm>,
+			AlgorithmOutput<std::tuple_element_t<I == 0 ? 0 : I - 1, Algorithms>>>, "Adjacent algorithms have to match");
+
+		auto output = std::get<I>(algorithms).Algorithm::Compute(std::move(input));
+
+		if constexpr (I + 1 == algorithm_count) {
+			return output;
+		}
+		else {
+			return Apply<I + 1>(std::move(output));
+		}
+	}
+
+	template<size_t... Is>
+	std::string AlgorithmNames(std::index_sequence<Is...>) const {
+		std::string names{};
+		((names += (Is == 0 ? std::string() : std::string(",")) + std::get<Is>(algorithms).Name()), ...);
+		return names;
+	}
+
+	void InternallyCompute(std::future<T_input> future, std::promise<T_output> promise) override {
+		try {
+			auto input = await_future(future);
+			promise.set_value(Apply<0>(std::move(input)));
+		}
+		catch (...) {
+			promise.set_exception(std::current_exception());
+		}
+	}
+
+	T_output InternallyComputePure(T_input&& input) override {
+		return Apply<0>(std::move(input));
+	}
+
+	Future<T_output> InternallyComputeAsync(Future<T_input> input) override {
+		return input.Then([this](T_input&& value) {
+			return Apply<0>(std::move(value));
+		});
+	}
+
+#if defined(CPA_COROUTINES)
+	Task<T_output> InternallyComputeTask(T_input input) override {
+		co_await ScheduleOnWorker{};
+		co_return Apply<0>(std::move(input));
+	}
+#endif
+
+	explicit StaticComposition(Algorithms&& algorithms) : algorithms(std::move(algorithms)) { }
+
+public:
+	static PatIntPtr<T_input, T_output> create(T_algorithms... algorithms) {
+		auto composition = new StaticComposition(Algorithms(std::move(algorithms)...));
+		auto s_ptr = std::shared_ptr<PatternInterface<T_input, T_output>>(composition);
+		return s_ptr;
+	}
+
+	StaticComposition(const StaticComposition& other) = delete;
+	StaticComposition(StaticComposition&& other) = delete;
+
+	StaticComposition& operator=(const StaticComposition& other) = delete;
+	StaticComposition& operator=(StaticComposition&& other) = delete;
+
+	virtual ~StaticComposition() = default;
+
+	std::string Name() const override {
+		return std::string("static_composition(") + AlgorithmNames(std::make_index_sequence<algorithm_count>{}) + std::string(")");
+	}
+
+	size_t ThreadCount() const noexcept override {
+		return 0;
+	}
+
+	PatIntPtr<T_input, T_output> create_copy() override {
+		this->assertNoInit();
+
+		// Algorithms such as Increaser only declare a copy constructor taking a non-const reference.
+		auto copied_algorithms = std::apply([](auto&... algorithm) { return Algorithms(algorithm...); }, algorithms);
+
+		auto copied_version = new StaticComposition(std::move(copied_algorithms));
+		return std::shared_ptr<PatternInterface<T_input, T_output>>(copied_version);
+	}
+
+	bool IsBlocking() const noexcept override {
+		return true;
+	}
+
+	void Init() override {
+		((void)(0));
+	}
+
+	void Dispose() override {
+		((void)(0));
+	}
+};
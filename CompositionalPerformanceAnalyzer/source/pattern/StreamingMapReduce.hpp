@@ -0,0 +1,218 @@
+#pragma once
+
+#include "../Commons.hpp"
+#include "../interfaces/PatternInterface.hpp"
+#include "../interfaces/AlgorithmInterface.hpp"
+#include "../interfaces/Executor.hpp"
+#include "../interfaces/Scheduler.hpp"
+#include "../interfaces/ThreadSafeQueue.hpp"
+
+#include "../helper/mpi_helper.hpp"
+
+#include "MapReduce.hpp"
+
+#include <atomic>
+#include <cassert>
+#include <future>
+#include <map>
+#include <memory>
+#include <string>
+#include <tuple>
+#include <vector>
+
+// Maps inputs as they are pushed and folds every mapped value into a running aggregate per
+// key with the combiner, so memory grows with the number of keys instead of the number of
+// inputs. The aggregates live in one ShuffleCombiner buffer per scheduler worker, so a key
+// is held up to once per worker and the state grows as keys times workers. A high-water
+// mark bounds the inputs that are pushed but not mapped yet, Push waits for a free slot and
+// TryPush gives up instead. Snapshot reads the aggregates of the inputs folded so far,
+// Finish waits for all pushed inputs, merges the ranks like the other MapReduce variants
+// and starts a new stream. create_streaming returns the pattern itself for callers that
+// push inputs directly, create returns it as a pattern interface for compositions.
+template<typename T_input, typename T_output, typename T_key>
+class StreamingMapReduce : public PatternInterface<FutVec<T_input>, std::map<T_key, T_output>> {
+
+	typedef std::map<T_key, T_output> map_result;
+
+	size_t thread_count{};
+	size_t high_water_mark{};
+	size_t mpi_nodes{};
+
+	Executor<T_input, map_result> mapper{};
+	AlgoIntPtr<std::tuple<T_output, T_output>, T_output> combiner{};
+
+	TSBoundedQueue<T_input> input_queue;
+	ShuffleCombiner<T_key, T_output> aggregates;
+
+	std::atomic<size_t> pending{};
+
+	WorkerSlots slots;
+	TaskGroup tasks{};
+
+	bool PerformMapFunction() {
+		T_input input{};
+
+		auto success = input_queue.try_pop(input);
+
+		if (!success) {
+			return false;
+		}
+
+		auto result = mapper.Compute(std::move(input));
+
+		for (auto& [key, value] : result) {
+			aggregates.add(key, value);
+		}
+
+		pending.fetch_sub(1);
+
+		return true;
+	}
+
+	void Notify() {
+		slots.Notify(tasks, [this]() { return PerformMapFunction(); });
+	}
+
+	void Enqueue(T_input&& input) {
+		pending.fetch_add(1);
+		input_queue.push_reserved(std::move(input));
+		Notify();
+	}
+
+	StreamingMapReduce(PatIntPtr<T_input, map_result> mapper_task, AlgoIntPtr<std::tuple<T_output, T_output>, T_output> combiner,
+		size_t threads, size_t mpi_nodes, size_t high_water_mark)
+		: thread_count(threads), high_water_mark(high_water_mark), mpi_nodes(mpi_nodes), mapper(mapper_task), combiner(combiner),
+		input_queue(high_water_mark), aggregates(combiner), slots(threads) {
+	}
+
+protected:
+	void InternallyCompute(std::future<FutVec<T_input>> future, std::promise<map_result> promise) override {
+		FutVec<T_input> inputs = await_future(future);
+
+		for (std::future<T_input>& input : inputs) {
+			Push(await_future(input));
+		}
+
+		promise.set_value(Finish());
+	}
+
+public:
+	// A high-water mark of 0 leaves the input queue unbounded.
+	static std::shared_ptr<StreamingMapReduce> create_streaming(
+		PatIntPtr<T_input, map_result> mapper_task, AlgoIntPtr<std::tuple<T_output, T_output>, T_output> combiner,
+		size_t threads, size_t mpi_nodes, size_t high_water_mark = 0) {
+		assert(threads > 0 && mpi_nodes > 0);
+
+		auto mr = new StreamingMapReduce(mapper_task, combiner, threads, mpi_nodes, high_water_mark);
+		auto s_ptr = std::shared_ptr<StreamingMapReduce>(mr);
+		return s_ptr;
+	}
+
+	static PatIntPtr<FutVec<T_input>, map_result> create(
+		PatIntPtr<T_input, map_result> mapper_task, AlgoIntPtr<std::tuple<T_output, T_output>, T_output> combiner,
+		size_t threads, size_t mpi_nodes, size_t high_water_mark = 0) {
+		return create_streaming(mapper_task, combiner, threads, mpi_nodes, high_water_mark);
+	}
+
+	StreamingMapReduce(const StreamingMapReduce& other) = delete;
+	StreamingMapReduce(StreamingMapReduce&& other) = delete;
+
+	StreamingMapReduce& operator=(const StreamingMapReduce& other) = delete;
+	StreamingMapReduce& operator=(StreamingMapReduce&& other) = delete;
+
+	void Push(T_input input) {
+		this->assertInit();
+
+		Scheduler::Instance().WaitUntil([this]() { return input_queue.try_reserve(); });
+		Enqueue(std::move(input));
+	}
+
+	bool TryPush(T_input& input) {
+		this->assertInit();
+
+		if (!input_queue.try_reserve()) {
+			return false;
+		}
+
+		Enqueue(std::move(input));
+		return true;
+	}
+
+	map_result Snapshot() {
+		map_result result{};
+		aggregates.get(result);
+		return result;
+	}
+
+	// Must not run concurrently with Push. Only rank 0 receives the merged result.
+	map_result Finish() {
+		this->assertInit();
+
+		Scheduler::Instance().WaitUntil([this]() { return pending.load() == 0; });
+
+		auto result = Snapshot();
+		aggregates.clear();
+
+		if (mpi_nodes > 1) {
+			mpi_tree_reduce_map(result, static_cast<int>(mpi_nodes), [this](map_result& mine, map_result& received) {
+				for (auto& [key, value] : received) {
+					auto entry = mine.find(key);
+
+					if (entry == mine.end()) {
+						mine.emplace(key, std::move(value));
+						continue;
+					}
+
+					entry->second = combiner->Compute(std::make_tuple(std::move(entry->second), std::move(value)));
+				}
+			});
+		}
+
+		return result;
+	}
+
+	PatIntPtr<FutVec<T_input>, map_result> create_copy() override {
+		this->assertNoInit();
+
+		auto copy = create(mapper.GetTask(), combiner, thread_count, mpi_nodes, high_water_mark);
+		return copy;
+	}
+
+	size_t Backlog() const noexcept override {
+		return input_queue.size_approx();
+	}
+
+	void Init() override {
+		if (!this->initialized) {
+			this->dying = false;
+
+			mapper.Init();
+
+			this->initialized = true;
+		}
+	}
+
+	void Dispose() override {
+		if (this->initialized) {
+			this->dying = true;
+
+			tasks.Wait();
+
+			mapper.Dispose();
+
+			this->initialized = false;
+		}
+	}
+
+	size_t ThreadCount() const noexcept override {
+		return thread_count + mapper.ThreadCount();
+	}
+
+	std::string Name() const override {
+		return std::string("StreamingMapReduce(") + mapper.Name() + "," + combiner->Name() + "," + std::to_string(thread_count) + "," + std::to_string(mpi_nodes) + ")";
+	}
+
+	~StreamingMapReduce() {
+		StreamingMapReduce::Dispose();
+	}
+};
@@ -3,55 +3,167 @@
 #include "../Commons.hpp"
 #include "../interfaces/PatternInterface.hpp"
 #include "../interfaces/ThreadSafeQueue.hpp"
+#include "../interfaces/AsyncQueue.hpp"
 #include "../interfaces/Executor.hpp"
+#include "../interfaces/DispatchPolicy.hpp"
+#include "../interfaces/Future.hpp"
+#include "../interfaces/Scheduler.hpp"
 
+#include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <exception>
 #include <future>
-#include <thread>
+#include <iterator>
+#include <memory>
 #include <vector>
 
 template <typename T_input, typename  T_output>
 class TaskPool : public PatternInterface<T_input, T_output> {
-	std::vector<std::thread> threads{};
+	size_t thread_count{};
 
 	Executor<T_input, T_output> executor{};
 
-	TSQueue<std::tuple<std::future<T_input>, std::promise<T_output>>> inner_queue{};
+	// Inputs and batches wait here once they have arrived, so a worker never waits for one.
+	AsyncQueue<T_input, T_output> queue;
 
-	void PerformTask() {
-		while (!this->dying) {
-			std::tuple<std::future<T_input>, std::promise<T_output>> data{};
-			bool success = this->inner_queue.try_pop(data);
+	// The parts of a dequeued batch that wait for another worker. They belong to a batch that
+	// was already admitted, so they do not count against the high-water mark.
+	TSQueue<std::tuple<std::vector<T_input>, Promise<std::vector<T_output>>>> chunk_queue{};
 
-			if (!success) {
-				if (this->dying) {
-					break;
-				}
+	WorkerSlots slots;
+	TaskGroup tasks{};
 
-				std::this_thread::yield();
-				continue;
+	static std::vector<T_output> Concatenate(std::vector<std::vector<T_output>>&& parts) {
+		std::vector<T_output> outputs{};
+
+		for (auto& part : parts) {
+			std::move(part.begin(), part.end(), std::back_inserter(outputs));
+		}
+
+		return outputs;
+	}
+
+	// Blocking replicas run the chunk in place, so it holds the worker slot until it is done.
+	void ComputeChunk(std::vector<T_input> inputs, Promise<std::vector<T_output>> promise) {
+		if (executor.IsBlocking()) {
+			try {
+				promise.SetValue(executor.ComputeBatch(std::move(inputs)));
+			}
+			catch (...) {
+				promise.SetException(std::current_exception());
 			}
 
-			auto future = std::move(std::get<0>(data));
-			auto promise = std::move(std::get<1>(data));
+			return;
+		}
+
+		forward_to_promise(executor.ComputeBatchAsync(make_ready_future(std::move(inputs))), std::move(promise));
+	}
 
-			executor.Compute(std::move(future), std::move(promise));
+	bool PerformChunk() {
+		std::tuple<std::vector<T_input>, Promise<std::vector<T_output>>> data{};
+		bool success = this->chunk_queue.try_pop(data);
+
+		if (!success) {
+			return false;
 		}
+
+		ComputeChunk(std::move(std::get<0>(data)), std::move(std::get<1>(data)));
+
+		return true;
 	}
 
-	TaskPool(PatIntPtr<T_input, T_output>& task, size_t thread_count)
-		: threads(thread_count), executor(task, thread_count) { }
+	// Splits the batch into one chunk per worker, so a blocking task does not run the whole
+	// batch on the worker that dequeued it. Each chunk still reaches a replica as one batch.
+	bool PerformBatch() {
+		std::vector<T_input> inputs{};
+		Promise<std::vector<T_output>> promise{};
+
+		if (!queue.PopBatch(inputs, promise)) {
+			return false;
+		}
+
+		auto chunk_count = std::max(size_t(1), std::min(thread_count, inputs.size()));
+		auto chunk = [&inputs, chunk_count](size_t index) {
+			auto begin = inputs.begin() + index * inputs.size() / chunk_count;
+			auto end = inputs.begin() + (index + 1) * inputs.size() / chunk_count;
+
+			return std::vector<T_input>(std::make_move_iterator(begin), std::make_move_iterator(end));
+		};
+
+		std::vector<Promise<std::vector<T_output>>> parts(chunk_count);
+		std::vector<Future<std::vector<T_output>>> outputs{};
+
+		for (auto& part : parts) {
+			outputs.emplace_back(part.GetFuture());
+		}
+
+		forward_to_promise(when_all(std::move(outputs)).Then(Concatenate), std::move(promise));
+
+		// The other chunks are queued first, so free workers pick them up while this one
+		// computes the first chunk.
+		for (auto i = 1ull; i < chunk_count; i++) {
+			chunk_queue.push(std::make_tuple(chunk(i), parts[i]));
+			Notify();
+		}
+
+		ComputeChunk(chunk(0), parts[0]);
+
+		return true;
+	}
+
+	bool Perform() {
+		queue.Admit();
+		return queue.Perform(executor) || PerformChunk() || PerformBatch();
+	}
+
+	void Notify() {
+		slots.Notify(tasks, [this]() { return Perform(); });
+	}
+
+	TaskPool(PatIntPtr<T_input, T_output>& task, size_t thread_count, size_t high_water_mark, DispatchPolicyPtr policy)
+		: thread_count(thread_count), executor(task, thread_count, policy), queue(high_water_mark), slots(thread_count) { }
 
 protected:
 	void InternallyCompute(std::future<T_input> future, std::promise<T_output> promise) override {
-		inner_queue.push(std::make_tuple(std::move(future), std::move(promise)));
+		Scheduler::Instance().WaitUntil([this]() { return queue.TryReserve(); });
+		forward_to_promise(queue.PushReserved(to_future(std::move(future)), [this]() { Notify(); }), std::move(promise));
+	}
+
+	bool InternallyTryCompute(std::future<T_input>& future, std::promise<T_output>& promise) override {
+		if (!queue.TryReserve()) {
+			return false;
+		}
+
+		forward_to_promise(queue.PushReserved(to_future(std::move(future)), [this]() { Notify(); }), std::move(promise));
+		return true;
+	}
+
+	void InternallyComputeBatch(std::future<std::vector<T_input>> future, std::promise<std::vector<T_output>> promise) override {
+		Scheduler::Instance().WaitUntil([this]() { return queue.TryReserve(); });
+		forward_to_promise(queue.PushBatchReserved(to_future(std::move(future)), [this]() { Notify(); }), std::move(promise));
+	}
+
+	Future<std::vector<T_output>> InternallyComputeBatchAsync(Future<std::vector<T_input>> input) override {
+		return queue.PushBatch(std::move(input), [this]() { Notify(); });
+	}
+
+	// Shares the high-water mark and the workers with Compute(), an input that finds the
+	// queue full waits without blocking the caller. Coroutines reach this through the default
+	// InternallyComputeTask.
+	Future<T_output> InternallyComputeAsync(Future<T_input> input) override {
+		return queue.Push(std::move(input), [this]() { Notify(); });
 	}
 
 public:
-	static PatIntPtr<T_input, T_output> create(PatIntPtr<T_input, T_output> task, size_t thread_count) {
+	// A high_water_mark above 0 bounds the number of queued inputs, Compute() then blocks and
+	// TryCompute() fails until the workers have drained the queue below the mark.
+	// The policy picks the copy of the task for each input, round robin by default.
+	static PatIntPtr<T_input, T_output> create(PatIntPtr<T_input, T_output> task, size_t thread_count,
+		size_t high_water_mark = 0, DispatchPolicyPtr policy = DispatchPolicyPtr()) {
 		assert(thread_count > 0);
 
-		auto pool = new TaskPool(task, thread_count);
+		auto pool = new TaskPool(task, thread_count, high_water_mark, policy);
 		auto s_ptr = std::shared_ptr<PatternInterface<T_input, T_output>>(pool);
 		return s_ptr;
 	}
@@ -63,17 +175,21 @@ public:
 	TaskPool& operator=(TaskPool&& other) = delete;
 
 	size_t ThreadCount() const noexcept override {
-		return threads.size() * executor.ThreadCount();
+		return thread_count * executor.ThreadCount();
+	}
+
+	size_t Backlog() const noexcept override {
+		return queue.Occupied() + queue.Waiting();
 	}
 
 	std::string Name() const override {
-		return std::string("taskpool(") + std::to_string(threads.size()) + std::string(",") + executor.Name() + std::string(")");
+		return std::string("taskpool(") + std::to_string(thread_count) + std::string(",") + executor.Name() + std::string(")");
 	}
 
 	PatIntPtr<T_input, T_output> create_copy() override {
 		this->assertNoInit();
 
-		auto copied_version = create(executor.GetTask(), threads.size());
+		auto copied_version = create(executor.GetTask(), thread_count, queue.Capacity(), executor.GetPolicy()->create_copy());
 		return copied_version;
 	}
 
@@ -83,10 +199,6 @@ public:
 
 			executor.Init();
 
-			for (unsigned i = 0; i < threads.size(); i++) {
-				threads[i] = std::thread(&TaskPool::PerformTask, this);
-			}
-
 			this->initialized = true;
 		}
 	}
@@ -95,11 +207,7 @@ public:
 		if (this->initialized) {
 			this->dying = true;
 
-			for (std::thread& thread : threads) {
-				if (thread.joinable()) {
-					thread.join();
-				}
-			}
+			tasks.Wait();
 
 			executor.Dispose();
 
@@ -0,0 +1,558 @@
+#pragma once
+
+#include "../algorithms/Partitioner.hpp"
+#include "../algorithms/ReduceAdd.hpp"
+
+#include "../helper/futurepacker.hpp"
+#include "../helper/mpi_helper.hpp"
+#include "../helper/radixsort.hpp"
+
+#include "../interfaces/AlgorithmInterface.hpp"
+#include "../interfaces/AlgorithmWrapper.hpp"
+
+#include "../pattern/MapReduce.hpp"
+#include "../pattern/StreamingMapReduce.hpp"
+
+#include <algorithm>
+#include <future>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// A trivially copyable type without a specialization, sent as its raw bytes.
+struct SerializerPoint {
+	int x{};
+	double y{};
+
+	bool operator==(const SerializerPoint& other) const {
+		return x == other.x && y == other.y;
+	}
+};
+
+// Packs the value, checks that size() matches the bytes written and that unpacking reads
+// exactly those bytes back into an equal value.
+template<typename T>
+bool round_trips(const T& value, const std::string& name) {
+	std::vector<char> buffer{};
+	mpi_pack(value, buffer);
+
+	if (buffer.size() != mpi_serializer<T>::size(value)) {
+		std::cerr << "mpi_serializer<" << name << "> wrote another size than it announced" << std::endl;
+		return false;
+	}
+
+	T unpacked{};
+	const char* in = buffer.data();
+	mpi_unpack(in, unpacked);
+
+	if (in != buffer.data() + buffer.size() || !(unpacked == value)) {
+		std::cerr << "mpi_serializer<" << name << "> did not read the value back" << std::endl;
+		return false;
+	}
+
+	return true;
+}
+
+// Every specialization of mpi_serializer, nested in each other, and two values packed into
+// one buffer one after the other.
+inline bool test_serializers_round_trip() {
+	auto success = round_trips(42, "int")
+		&& round_trips(SerializerPoint{ -3, 2.5 }, "SerializerPoint")
+		&& round_trips(std::vector<long>{ 1, -2, 3 }, "vector<long>")
+		&& round_trips(std::vector<long>{}, "empty vector<long>")
+		&& round_trips(std::string("keyed"), "string")
+		&& round_trips(std::string(), "empty string")
+		&& round_trips(std::vector<std::string>{ "a", "", "ccc" }, "vector<string>")
+		&& round_trips(std::vector<std::vector<int>>{ { 1 }, {}, { 2, 3 } }, "vector<vector<int>>")
+		&& round_trips(std::make_pair(7, std::string("seven")), "pair<int, string>")
+		&& round_trips(std::make_tuple(5l, std::vector<int>{ 4, 5 }, std::string("five")), "tuple<long, vector<int>, string>")
+		&& round_trips(std::map<std::string, std::vector<long>>{ { "x", { 1, 2 } }, { "y", {} } }, "map<string, vector<long>>")
+		&& round_trips(std::map<int, SerializerPoint>{}, "empty map<int, SerializerPoint>");
+
+	std::vector<char> buffer{};
+	mpi_pack(std::string("first"), buffer);
+	mpi_pack(std::vector<int>{ 1, 2 }, buffer);
+
+	std::string first{};
+	std::vector<int> second{};
+
+	const char* in = buffer.data();
+	mpi_unpack(in, first);
+	mpi_unpack(in, second);
+
+	if (first != "first" || second != std::vector<int>{ 1, 2 } || in != buffer.data() + buffer.size()) {
+		std::cerr << "mpi_pack did not append to the buffer" << std::endl;
+		success = false;
+	}
+
+	return success;
+}
+
+// Every rank but the root is the child of its parent, so the merge reaches all ranks, and a
+// single node keeps its map without merging anything.
+inline bool test_tree_reduce_covers_all_ranks() {
+	auto success = true;
+
+	for (auto nodes = 1; nodes <= 13; nodes++) {
+		std::vector<int> reached(nodes);
+		reached[0] = 1;
+
+		for (auto rank = 0; rank < nodes; rank++) {
+			for (auto child : mpi_tree_children(rank, nodes)) {
+				if (child <= rank || child >= nodes || mpi_tree_parent(child) != rank) {
+					std::cerr << "Rank " << rank << " of " << nodes << " has the wrong child " << child << std::endl;
+					success = false;
+					continue;
+				}
+
+				reached[child]++;
+			}
+		}
+
+		for (auto rank = 0; rank < nodes; rank++) {
+			if (reached[rank] != 1) {
+				std::cerr << "The tree over " << nodes << " ranks reaches rank " << rank << " " << reached[rank] << " times" << std::endl;
+				success = false;
+			}
+		}
+	}
+
+	std::map<int, int> map{ { 1, 10 }, { 2, 20 } };
+	auto merges = 0;
+
+	mpi_tree_reduce_map(map, 1, [&merges](std::map<int, int>&, std::map<int, int>&) { merges++; });
+
+	if (merges != 0 || map != std::map<int, int>{ { 1, 10 }, { 2, 20 } }) {
+		std::cerr << "mpi_tree_reduce_map changed the map of a single node" << std::endl;
+		success = false;
+	}
+
+	return success;
+}
+
+// Sorts random pairs with sort_by_key and compares them to std::stable_sort by key. The
+// radix sort is stable, so it has to match exactly. Below the threshold and for other
+// keys std::sort runs, which only has to give the same keys and the same pairs.
+template<typename T_key, typename Generate>
+bool sorts_like_std_sort(size_t count, Generate generate, const std::string& name) {
+	std::vector<std::pair<T_key, size_t>> pairs{};
+
+	for (size_t i = 0; i < count; i++) {
+		pairs.emplace_back(generate(), i);
+	}
+
+	auto expected = pairs;
+	std::stable_sort(expected.begin(), expected.end(), [](const auto& first, const auto& second) { return first.first < second.first; });
+
+	sort_by_key(pairs);
+
+	auto exact = std::is_integral_v<T_key> && count >= radix_sort_threshold;
+	auto same_keys = std::equal(pairs.begin(), pairs.end(), expected.begin(), expected.end(),
+		[](const auto& first, const auto& second) { return first.first == second.first; });
+
+	if (exact ? pairs != expected : !same_keys || !std::is_permutation(pairs.begin(), pairs.end(), expected.begin(), expected.end())) {
+		std::cerr << "sort_by_key sorted " << count << " " << name << " keys wrongly" << std::endl;
+		return false;
+	}
+
+	return true;
+}
+
+inline bool test_radix_sort_matches_std_sort() {
+	std::mt19937_64 random(42);
+
+	auto any_int = [&random]() { return static_cast<int>(random()); };
+	auto narrow_long = [&random]() { return static_cast<long>(random() % 1000) - 500; };
+	auto any_unsigned = [&random]() { return static_cast<unsigned long long>(random()); };
+	auto any_short = [&random]() { return static_cast<short>(random()); };
+	auto any_string = [&random]() { return std::to_string(random() % 100); };
+
+	auto success = true;
+
+	for (size_t count : { size_t(0), size_t(1), radix_sort_threshold - 1, radix_sort_threshold, size_t(5000) }) {
+		success = sorts_like_std_sort<int>(count, any_int, "int") && success;
+		success = sorts_like_std_sort<long>(count, narrow_long, "narrow long") && success;
+		success = sorts_like_std_sort<unsigned long long>(count, any_unsigned, "unsigned long long") && success;
+		success = sorts_like_std_sort<short>(count, any_short, "short") && success;
+		success = sorts_like_std_sort<std::string>(count, any_string, "string") && success;
+	}
+
+	for (size_t count : { size_t(0), size_t(1), size_t(2) }) {
+		std::vector<std::pair<int, int>> pairs(count, std::make_pair(1, 1));
+		radix_sort_by_key(pairs);
+
+		if (pairs.size() != count) {
+			std::cerr << "radix_sort_by_key changed a vector of " << count << " pairs" << std::endl;
+			success = false;
+		}
+	}
+
+	return success;
+}
+
+// Two partitioners built alike assign the keys alike, in a batch and key by key, and every
+// one of their ranks receives some of the keys.
+inline bool partitions_alike(Partitioner<long>& first, Partitioner<long>& second, const std::vector<long>& keys) {
+	std::vector<int> ranks{};
+	std::vector<int> ranks_again{};
+
+	first.ComputeBatch(keys, ranks);
+	second.ComputeBatch(keys, ranks_again);
+
+	if (ranks != ranks_again) {
+		std::cerr << first.Name() << " assigned the same keys differently" << std::endl;
+		return false;
+	}
+
+	std::vector<size_t> keys_per_rank(first.Nodes());
+
+	for (size_t i = 0; i < keys.size(); i++) {
+		if (ranks[i] < 0 || ranks[i] >= first.Nodes() || first.Compute(long(keys[i])) != ranks[i]) {
+			std::cerr << first.Name() << " assigned key " << keys[i] << " to rank " << ranks[i] << std::endl;
+			return false;
+		}
+
+		keys_per_rank[ranks[i]]++;
+	}
+
+	if (std::find(keys_per_rank.begin(), keys_per_rank.end(), size_t(0)) != keys_per_rank.end()) {
+		std::cerr << first.Name() << " left a rank without keys" << std::endl;
+		return false;
+	}
+
+	return true;
+}
+
+inline bool test_partitioners_are_deterministic() {
+	const auto nodes = 5;
+
+	std::vector<long> keys(10000);
+
+	for (size_t i = 0; i < keys.size(); i++) {
+		keys[i] = static_cast<long>(i) * 3 - 5000;
+	}
+
+	std::vector<long> splits{ -2000, 2000, 8000, 16000 };
+
+	HashPartitioner<long> hash(nodes);
+	HashPartitioner<long> hash_again(nodes);
+	RangePartitioner<long> range(splits);
+	RangePartitioner<long> range_again(splits);
+	ConsistentHashPartitioner<long> ring(nodes);
+	ConsistentHashPartitioner<long> ring_again(nodes);
+	LoadBalancedPartitioner<long> balanced(nodes);
+	LoadBalancedPartitioner<long> balanced_again(nodes);
+
+	auto success = range.Nodes() == nodes && partitions_alike(hash, hash_again, keys) && partitions_alike(range, range_again, keys)
+		&& partitions_alike(ring, ring_again, keys) && partitions_alike(balanced, balanced_again, keys);
+
+	// A few hot keys and many cold ones. The balanced assignment of the heaviest key alone
+	// is the best any partitioner can do.
+	std::map<long, size_t> histogram{};
+
+	for (auto key : keys) {
+		histogram.emplace(key, key % 1000 == 0 ? 1000 : 1);
+	}
+
+	balanced.Observe(histogram);
+	balanced_again.Observe(histogram);
+
+	success = partitions_alike(balanced, balanced_again, keys) && success;
+
+	std::vector<int> ranks{};
+	balanced.ComputeBatch(keys, ranks);
+
+	std::vector<size_t> load(nodes);
+	auto total = 0ull;
+
+	for (size_t i = 0; i < keys.size(); i++) {
+		load[ranks[i]] += histogram[keys[i]];
+		total += histogram[keys[i]];
+	}
+
+	if (*std::max_element(load.begin(), load.end()) > total / nodes + 1000) {
+		std::cerr << balanced.Name() << " did not balance the observed values" << std::endl;
+		success = false;
+	}
+
+	return success;
+}
+
+// Fills a collection far beyond its memory budget, so every shard spills more runs than it
+// keeps and compacts them. Both ways of reading it back have to return every value of a key
+// in the order it was added.
+inline bool test_spilled_collection_round_trips() {
+	const auto shard_count = 4;
+	const auto memory_budget = 256;
+
+	ThreadSafeKeyedCollection<long, long> taken(shard_count, memory_budget);
+	ThreadSafeKeyedCollection<long, long> consumed(shard_count, memory_budget);
+
+	std::map<long, std::vector<long>> expected{};
+
+	for (long value = 0; value < 8000; value++) {
+		auto key = (value * 7) % 200;
+
+		taken.add(key, value);
+		consumed.add(key, value);
+		expected[key].emplace_back(value);
+	}
+
+	auto success = true;
+
+	if (!taken.spilled() || !consumed.spilled()) {
+		std::cerr << "ThreadSafeKeyedCollection did not spill beyond its memory budget" << std::endl;
+		success = false;
+	}
+
+	std::map<long, std::vector<long>> from_get{};
+	taken.get(from_get);
+
+	std::map<long, std::vector<long>> from_consume{};
+	auto calls = 0;
+
+	consumed.consume([&from_consume, &calls](std::map<long, std::vector<long>>& values) {
+		from_consume.merge(values);
+		calls++;
+	});
+
+	if (from_get != expected || from_consume != expected) {
+		std::cerr << "ThreadSafeKeyedCollection lost or reordered spilled values" << std::endl;
+		success = false;
+	}
+
+	if (calls != shard_count) {
+		std::cerr << "ThreadSafeKeyedCollection consumed " << calls << " shards instead of " << shard_count << std::endl;
+		success = false;
+	}
+
+	return success;
+}
+
+// Counts how often each key occurs in a line.
+class KeyCounter : public AlgorithmInterface<std::vector<long>, std::map<long, long>> {
+public:
+	std::map<long, long> Compute(std::vector<long>&& line) const override {
+		std::map<long, long> counts{};
+
+		for (auto key : line) {
+			counts[key]++;
+		}
+
+		return counts;
+	}
+
+	std::string Name() const override {
+		return std::string("key_counter");
+	}
+};
+
+inline std::vector<std::vector<long>> key_lines() {
+	std::vector<std::vector<long>> lines(40);
+
+	for (long i = 0; i < 40; i++) {
+		for (long j = 0; j < 500; j++) {
+			lines[i].emplace_back(j % 5 == 0 ? 7 : (i * 31 + j * 17) % 300);
+		}
+	}
+
+	return lines;
+}
+
+template<typename T_input, typename T_key, typename T_output>
+std::map<T_key, T_output> run_map_reduce(PatIntPtr<FutVec<T_input>, std::map<T_key, T_output>> pattern, std::vector<T_input> inputs) {
+	pattern->Init();
+
+	std::promise<FutVec<T_input>> promise{};
+	promise.set_value(future_packer(std::move(inputs)));
+
+	auto result = pattern->Compute(promise.get_future()).get();
+	pattern->Dispose();
+
+	return result;
+}
+
+// The combiner only merges values of a key before the shuffle, so turning it on must not
+// change the result of either shuffle mode.
+inline bool test_combiner_keeps_results() {
+	auto mapper = AlgorithmWrapper<std::vector<long>, std::map<long, long>>::create(std::make_shared<KeyCounter>());
+	auto reducer = AlgorithmWrapper<std::vector<long>, long>::create(std::make_shared<ReduceAddVector<long>>(0));
+	auto combiner = std::make_shared<ReduceAdd<long, long>>();
+	auto distributer = std::make_shared<HashPartitioner<long>>(1);
+
+	std::map<long, long> expected{};
+
+	for (auto& line : key_lines()) {
+		for (auto key : line) {
+			expected[key]++;
+		}
+	}
+
+	auto success = true;
+
+	for (auto mode : { ShuffleMode::Hashed, ShuffleMode::Sorted }) {
+		for (auto with_combiner : { false, true }) {
+			auto used_combiner = with_combiner ? combiner : nullptr;
+
+			auto local = MapReduceLocalH<std::vector<long>, long, long, long>::create(mapper, reducer, 4, 1, used_combiner, 0, mode);
+			auto global = MapReduceGlobalH<std::vector<long>, long, long, long>::create(mapper, reducer, 4, 1, distributer, used_combiner, 0, mode);
+
+			for (auto& pattern : { local, global }) {
+				if (run_map_reduce(pattern, key_lines()) != expected) {
+					std::cerr << pattern->Name() << " returned a wrong result " << (with_combiner ? "with" : "without")
+						<< " combiner in the " << (mode == ShuffleMode::Sorted ? "sorted" : "hashed") << " shuffle" << std::endl;
+					success = false;
+				}
+			}
+		}
+	}
+
+	return success;
+}
+
+typedef std::map<std::string, long> word_counts;
+
+class WordCounter : public AlgorithmInterface<std::vector<std::string>, word_counts> {
+public:
+	word_counts Compute(std::vector<std::string>&& line) const override {
+		word_counts counts{};
+
+		for (auto& word : line) {
+			counts[word]++;
+		}
+
+		return counts;
+	}
+
+	std::string Name() const override {
+		return std::string("word_counter");
+	}
+};
+
+class MergeWordCounts : public AlgorithmInterface<std::tuple<word_counts, word_counts>, word_counts> {
+public:
+	word_counts Compute(std::tuple<word_counts, word_counts>&& value) const override {
+		auto& counts = std::get<0>(value);
+
+		for (auto& [word, count] : std::get<1>(value)) {
+			counts[word] += count;
+		}
+
+		return std::move(counts);
+	}
+
+	std::string Name() const override {
+		return std::string("merge_word_counts");
+	}
+};
+
+inline std::vector<std::vector<std::string>> word_lines() {
+	const std::vector<std::string> words{ "map", "reduce", "shuffle", "key", "value", "rank", "the", "a" };
+
+	std::vector<std::vector<std::string>> lines(30);
+
+	for (size_t i = 0; i < lines.size(); i++) {
+		for (size_t j = 0; j < 200; j++) {
+			lines[i].emplace_back(words[(i * j + j / 3) % words.size()] + std::to_string(j % (i + 1)));
+		}
+	}
+
+	return lines;
+}
+
+// All three MapReduce variants count the words of the same lines on one rank.
+inline bool test_map_reduce_counts_words() {
+	auto mapper = AlgorithmWrapper<std::vector<std::string>, word_counts>::create(std::make_shared<WordCounter>());
+	auto reducer = AlgorithmWrapper<std::vector<long>, long>::create(std::make_shared<ReduceAddVector<long>>(0));
+	auto merger = AlgorithmWrapper<std::tuple<word_counts, word_counts>, word_counts>::create(std::make_shared<MergeWordCounts>());
+	auto distributer = std::make_shared<HashPartitioner<std::string>>(1);
+
+	word_counts expected{};
+
+	for (auto& line : word_lines()) {
+		for (auto& word : line) {
+			expected[word]++;
+		}
+	}
+
+	typedef std::vector<std::string> line;
+
+	std::vector<PatIntPtr<FutVec<line>, word_counts>> patterns{
+		MapReduceGlobalH<line, long, std::string, long>::create(mapper, reducer, 4, 1, distributer),
+		MapReduceGlobalH<line, long, std::string, long>::create(mapper, reducer, 4, 1, distributer, nullptr, 0, ShuffleMode::Hashed, true),
+		MapReduceLocalH<line, long, std::string, long>::create(mapper, reducer, 4, 1),
+		MapReduceLocalV<line, long, std::string>::create(mapper, merger, 4, 1)
+	};
+
+	auto success = true;
+
+	for (auto& pattern : patterns) {
+		if (run_map_reduce(pattern, word_lines()) != expected) {
+			std::cerr << pattern->Name() << " counted the words wrongly" << std::endl;
+			success = false;
+		}
+	}
+
+	return success;
+}
+
+// Pushing lines one by one folds them into the same counts as a batch, Snapshot sees the
+// lines pushed so far and Finish starts a new stream.
+inline bool test_streaming_counts_words() {
+	typedef std::vector<std::string> line;
+
+	auto mapper = AlgorithmWrapper<line, word_counts>::create(std::make_shared<WordCounter>());
+	auto combiner = std::make_shared<ReduceAdd<long, long>>();
+
+	auto lines = word_lines();
+
+	word_counts expected{};
+	word_counts first_line{};
+
+	for (auto& word : lines[0]) {
+		first_line[word]++;
+	}
+
+	for (auto& words : lines) {
+		for (auto& word : words) {
+			expected[word]++;
+		}
+	}
+
+	auto success = true;
+
+	auto stream = StreamingMapReduce<line, long, std::string>::create_streaming(mapper, combiner, 4, 1, 8);
+	stream->Init();
+
+	stream->Push(lines[0]);
+
+	// Finish waits for the pushed lines, a Snapshot right after Push may not see them yet.
+	if (stream->Finish() != first_line || !stream->Snapshot().empty()) {
+		std::cerr << stream->Name() << " did not start a new stream after Finish" << std::endl;
+		success = false;
+	}
+
+	for (auto& words : lines) {
+		stream->Push(words);
+	}
+
+	if (stream->Finish() != expected) {
+		std::cerr << stream->Name() << " counted the pushed words wrongly" << std::endl;
+		success = false;
+	}
+
+	stream->Dispose();
+
+	if (run_map_reduce(StreamingMapReduce<line, long, std::string>::create(mapper, combiner, 4, 1), word_lines()) != expected) {
+		std::cerr << stream->Name() << " counted a batch of words wrongly" << std::endl;
+		success = false;
+	}
+
+	return success;
+}
@@ -0,0 +1,460 @@
+#pragma once
+
+#include "../interfaces/AlgorithmInterface.hpp"
+#include "../interfaces/AlgorithmWrapper.hpp"
+#include "../interfaces/DispatchPolicy.hpp"
+#include "../interfaces/Executor.hpp"
+#include "../interfaces/Future.hpp"
+#include "../interfaces/Scheduler.hpp"
+
+#include "../pattern/Composition.hpp"
+#include "../pattern/Pipeline.hpp"
+#include "../pattern/TaskPool.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Records how many calls run at once. Each call blocks through the scheduler, which lets
+// spare threads pick up other tasks in the meantime, so a pattern that exceeds its worker
+// count shows up in the peak.
+class ConcurrencyProbe : public AlgorithmInterface<int, int> {
+	std::shared_ptr<std::atomic<size_t>> active;
+	std::shared_ptr<std::atomic<size_t>> peak;
+	std::chrono::microseconds delay;
+
+public:
+	ConcurrencyProbe(std::shared_ptr<std::atomic<size_t>> active, std::shared_ptr<std::atomic<size_t>> peak,
+		std::chrono::microseconds delay = std::chrono::microseconds(200))
+		: active(active), peak(peak), delay(delay) { }
+
+	int Compute(int&& value) const override {
+		auto now = active->fetch_add(1) + 1;
+		auto seen = peak->load();
+
+		while (now > seen && !peak->compare_exchange_weak(seen, now)) { }
+
+		Scheduler::Instance().Block([this]() { std::this_thread::sleep_for(delay); });
+
+		active->fetch_sub(1);
+		return value;
+	}
+
+	std::string Name() const override {
+		return std::string("concurrency_probe");
+	}
+};
+
+// Runs inputs through the pattern and returns the peak number of concurrent probe calls.
+inline size_t measure_peak_concurrency(PatIntPtr<int, int> pattern, std::shared_ptr<std::atomic<size_t>> peak, int inputs) {
+	pattern->Init();
+
+	std::vector<std::future<int>> outputs{};
+
+	// Inputs trickle in at about the rate the probe consumes them, so the queue keeps running
+	// empty while a worker is about to give its slot back.
+	for (auto i = 0; i < inputs; i++) {
+		std::promise<int> promise{};
+		promise.set_value(i);
+		outputs.emplace_back(pattern->Compute(promise.get_future()));
+
+		std::this_thread::sleep_for(std::chrono::microseconds((i * 37) % 300));
+	}
+
+	for (auto& output : outputs) {
+		output.get();
+	}
+
+	pattern->Dispose();
+
+	return peak->load();
+}
+
+// A stage with one worker has to run its inputs one after another, a TaskPool never runs
+// more inputs at once than its thread count.
+inline bool test_worker_slots_bound_concurrency() {
+	auto success = true;
+
+	for (size_t workers : { 1, 2 }) {
+		auto active = std::make_shared<std::atomic<size_t>>(0);
+		auto peak = std::make_shared<std::atomic<size_t>>(0);
+
+		auto probe = AlgorithmWrapper<int, int>::create(std::make_shared<ConcurrencyProbe>(active, peak));
+		auto pool = TaskPool<int, int>::create(probe, workers);
+
+		auto pool_peak = measure_peak_concurrency(pool, peak, 2000);
+
+		if (pool_peak > workers) {
+			std::cerr << "TaskPool with " << workers << " threads ran " << pool_peak << " inputs at once" << std::endl;
+			success = false;
+		}
+	}
+
+	auto active = std::make_shared<std::atomic<size_t>>(0);
+	auto peak = std::make_shared<std::atomic<size_t>>(0);
+
+	auto probe = AlgorithmWrapper<int, int>::create(std::make_shared<ConcurrencyProbe>(active, peak));
+	auto pass = AlgorithmWrapper<int, int>::create(std::make_shared<ConcurrencyProbe>(
+		std::make_shared<std::atomic<size_t>>(0), std::make_shared<std::atomic<size_t>>(0)));
+	auto pipe = Pipeline<int, int, int>::create(probe, pass);
+
+	auto stage_peak = measure_peak_concurrency(pipe, peak, 2000);
+
+	if (stage_peak > 1) {
+		std::cerr << "A single-worker pipeline stage ran " << stage_peak << " inputs at once" << std::endl;
+		success = false;
+	}
+
+	return success;
+}
+
+// ComputeAsync goes through the same queue and workers as Compute(), inputs beyond the
+// high-water mark wait without blocking the caller.
+inline bool test_async_submissions_bound_concurrency() {
+	auto success = true;
+
+	auto active = std::make_shared<std::atomic<size_t>>(0);
+	auto peak = std::make_shared<std::atomic<size_t>>(0);
+
+	auto probe = AlgorithmWrapper<int, int>::create(std::make_shared<ConcurrencyProbe>(active, peak));
+	auto pool = TaskPool<int, int>::create(probe, 2, 4);
+	auto pipe = Pipeline<int, int, int>::create_bounded({ 1, 1 }, { 2, 2 }, probe, probe);
+
+	for (auto& [pattern, workers] : { std::make_pair(pool, size_t(2)), std::make_pair(pipe, size_t(2)) }) {
+		peak->store(0);
+		pattern->Init();
+
+		std::vector<Future<int>> outputs{};
+
+		for (auto i = 0; i < 500; i++) {
+			outputs.emplace_back(pattern->ComputeAsync(make_ready_future(i)));
+		}
+
+		for (auto i = 0; i < 500; i++) {
+			if (outputs[i].Get() != i) {
+				std::cerr << pattern->Name() << " returned a wrong result for input " << i << std::endl;
+				success = false;
+			}
+		}
+
+		pattern->Dispose();
+
+		if (peak->load() > workers) {
+			std::cerr << pattern->Name() << " ran " << peak->load() << " asynchronous inputs at once" << std::endl;
+			success = false;
+		}
+	}
+
+	return success;
+}
+
+// Sends every input to the first replica and keeps the largest total load it was shown.
+class LoadProbeDispatch : public DispatchPolicy {
+	std::atomic<size_t> peak{};
+
+public:
+	static std::shared_ptr<LoadProbeDispatch> create() {
+		return std::make_shared<LoadProbeDispatch>();
+	}
+
+	size_t Select(size_t replica_count, const LoadFunction& load) override {
+		auto total = 0ull;
+
+		for (auto i = 0ull; i < replica_count; i++) {
+			total += load(i);
+		}
+
+		auto seen = peak.load();
+		while (total > seen && !peak.compare_exchange_weak(seen, total)) { }
+
+		return 0;
+	}
+
+	DispatchPolicyPtr create_copy() const override {
+		return create();
+	}
+
+	std::string Name() const override {
+		return std::string("load_probe");
+	}
+
+	size_t Peak() const noexcept {
+		return peak.load();
+	}
+};
+
+// Signals the first call and holds every call until the gate opens, so a test can look at
+// the load of a replica while an input is known to be running in it.
+class GateProbe : public AlgorithmInterface<int, int> {
+	std::shared_ptr<std::promise<void>> entered;
+	std::shared_ptr<std::atomic<bool>> signalled;
+	std::shared_future<void> gate;
+
+public:
+	GateProbe(std::shared_ptr<std::promise<void>> entered, std::shared_future<void> gate)
+		: entered(entered), signalled(std::make_shared<std::atomic<bool>>(false)), gate(gate) { }
+
+	int Compute(int&& value) const override {
+		if (!signalled->exchange(true)) {
+			entered->set_value();
+		}
+
+		Scheduler::Instance().Block([this]() { gate.wait(); });
+
+		return value;
+	}
+
+	std::string Name() const override {
+		return std::string("gate_probe");
+	}
+};
+
+// Submits an input through one of the std::future entry points of the executor and returns
+// a check that waits for its output.
+typedef std::function<std::function<bool()>(Executor<int, int>&, int)> FutureSubmission;
+
+// The gated probe runs in the last stage, where the replica no longer counts the input in
+// its backlog. Only the in-flight count of the executor can show it to the second input.
+inline bool executor_counts_gated_input(const std::string& entry_point, FutureSubmission submit) {
+	auto active = std::make_shared<std::atomic<size_t>>(0);
+	auto peak = std::make_shared<std::atomic<size_t>>(0);
+
+	auto entered = std::make_shared<std::promise<void>>();
+	auto entered_future = entered->get_future();
+	std::promise<void> gate{};
+
+	auto probe = AlgorithmWrapper<int, int>::create(std::make_shared<ConcurrencyProbe>(active, peak));
+	auto gated = AlgorithmWrapper<int, int>::create(std::make_shared<GateProbe>(entered, gate.get_future().share()));
+	auto pipe = Pipeline<int, int, int>::create(probe, gated);
+
+	auto policy = LoadProbeDispatch::create();
+	Executor<int, int> executor(pipe, 2, policy);
+	executor.Init();
+
+	auto first = submit(executor, 0);
+	entered_future.wait();
+
+	auto second = submit(executor, 1);
+	gate.set_value();
+
+	auto success = first() && second();
+	executor.Dispose();
+
+	if (!success) {
+		std::cerr << entry_point << " returned a wrong result" << std::endl;
+	}
+
+	if (policy->Peak() == 0) {
+		std::cerr << entry_point << " did not count an input that was running in a replica" << std::endl;
+		success = false;
+	}
+
+	return success;
+}
+
+// An input that a load-aware executor handed to a replica as a std::future counts as load
+// until its result is set, also after the replica took it out of its queues.
+inline bool test_executor_counts_future_inputs() {
+	auto promised = executor_counts_gated_input("Compute(future, promise)", [](Executor<int, int>& executor, int value) {
+		std::promise<int> input{};
+		input.set_value(value);
+
+		std::promise<int> promise{};
+		auto output = std::make_shared<std::future<int>>(promise.get_future());
+
+		executor.Compute(input.get_future(), std::move(promise));
+		return std::function<bool()>([output, value]() { return output->get() == value; });
+	});
+
+	auto returned = executor_counts_gated_input("Compute(future)", [](Executor<int, int>& executor, int value) {
+		std::promise<int> input{};
+		input.set_value(value);
+
+		auto output = std::make_shared<std::future<int>>(executor.Compute(input.get_future()));
+		return std::function<bool()>([output, value]() { return output->get() == value; });
+	});
+
+	auto batched = executor_counts_gated_input("ComputeBatch(future, promise)", [](Executor<int, int>& executor, int value) {
+		std::promise<std::vector<int>> input{};
+		input.set_value(std::vector<int>{ value });
+
+		std::promise<std::vector<int>> promise{};
+		auto output = std::make_shared<std::future<std::vector<int>>>(promise.get_future());
+
+		executor.ComputeBatch(input.get_future(), std::move(promise));
+		return std::function<bool()>([output, value]() { return output->get() == std::vector<int>{ value }; });
+	});
+
+	return promised && returned && batched;
+}
+
+// A TaskPool spreads a batch over its threads, but never runs more inputs at once than it
+// has threads, and returns the outputs in the order of the inputs.
+inline bool test_batch_spreads_over_workers() {
+	auto success = true;
+
+	auto active = std::make_shared<std::atomic<size_t>>(0);
+	auto peak = std::make_shared<std::atomic<size_t>>(0);
+
+	auto probe = AlgorithmWrapper<int, int>::create(std::make_shared<ConcurrencyProbe>(active, peak, std::chrono::milliseconds(2)));
+	auto pool = TaskPool<int, int>::create(probe, 2);
+	pool->Init();
+
+	std::vector<int> inputs(17);
+
+	for (auto i = 0; i < 17; i++) {
+		inputs[i] = i;
+	}
+
+	auto outputs = pool->ComputeBatch(inputs).get();
+	pool->Dispose();
+
+	if (outputs != inputs) {
+		std::cerr << "TaskPool returned a batch in the wrong order" << std::endl;
+		success = false;
+	}
+
+	if (peak->load() != 2) {
+		std::cerr << "TaskPool with 2 threads ran " << peak->load() << " inputs of a batch at once" << std::endl;
+		success = false;
+	}
+
+	return success;
+}
+
+// Throws for odd inputs and passes even ones through.
+class ThrowOnOdd : public AlgorithmInterface<int, int> {
+public:
+	int Compute(int&& value) const override {
+		if (value % 2 != 0) {
+			throw std::runtime_error("odd input");
+		}
+
+		return value;
+	}
+
+	std::string Name() const override {
+		return std::string("throw_on_odd");
+	}
+};
+
+// Returns true if calling get throws the exception of ThrowOnOdd.
+template<typename Get>
+bool throws_odd_input(Get get) {
+	try {
+		get();
+	}
+	catch (const std::runtime_error&) {
+		return true;
+	}
+
+	return false;
+}
+
+// An exception thrown in a stage reaches the caller through get() on every path instead of
+// leaving the output unset.
+inline bool test_exceptions_reach_the_caller() {
+	auto success = true;
+
+	auto pass = AlgorithmWrapper<int, int>::create(std::make_shared<ConcurrencyProbe>(
+		std::make_shared<std::atomic<size_t>>(0), std::make_shared<std::atomic<size_t>>(0)));
+	auto thrower = AlgorithmWrapper<int, int>::create(std::make_shared<ThrowOnOdd>());
+
+	auto pool = TaskPool<int, int>::create(thrower, 2);
+	auto pipe = Pipeline<int, int, int>::create(thrower, pass);
+	auto balanced = TaskPool<int, int>::create(pipe, 2, 0, LeastOutstandingDispatch::create());
+
+	for (auto& pattern : { pool, pipe, balanced }) {
+		pattern->Init();
+
+		for (auto i = 0; i < 4; i++) {
+			std::promise<int> input{};
+			input.set_value(i);
+
+			auto output = pattern->Compute(input.get_future());
+			auto output_async = pattern->ComputeAsync(make_ready_future(i));
+			auto outputs_batch = pattern->ComputeBatch(std::vector<int>{ 0, i });
+
+			auto odd = i % 2 != 0;
+
+			if (throws_odd_input([&output]() { output.get(); }) != odd
+				|| throws_odd_input([&output_async]() { output_async.Get(); }) != odd
+				|| throws_odd_input([&outputs_batch]() { outputs_batch.get(); }) != odd) {
+				std::cerr << pattern->Name() << " did not pass on the exception of input " << i << std::endl;
+				success = false;
+			}
+
+#if defined(CPA_COROUTINES)
+			auto output_task = pattern->ComputeTask(i).ToFuture();
+
+			if (throws_odd_input([&output_task]() { output_task.Get(); }) != odd) {
+				std::cerr << pattern->Name() << " did not pass on the exception of input " << i << " to a coroutine" << std::endl;
+				success = false;
+			}
+#endif
+		}
+
+		pattern->Dispose();
+	}
+
+	auto chained = make_ready_future(1).Then([](int&& value) {
+		return value + 1;
+	}).Then([](int&& value) -> int {
+		throw std::runtime_error("odd input");
+	}).Then([](int&& value) {
+		return value + 1;
+	});
+
+	if (!throws_odd_input([&chained]() { chained.Get(); })) {
+		std::cerr << "Then did not pass on an exception" << std::endl;
+		success = false;
+	}
+
+	return success;
+}
+
+// ComputeBatch returns before its input has arrived, on a blocking pattern as well as on a
+// composition that gathers the outputs of its elements.
+inline bool test_batch_does_not_wait_for_its_input() {
+	auto success = true;
+
+	auto make_probe = []() {
+		return AlgorithmWrapper<int, int>::create(std::make_shared<ConcurrencyProbe>(
+			std::make_shared<std::atomic<size_t>>(0), std::make_shared<std::atomic<size_t>>(0)));
+	};
+
+	auto single = make_probe();
+	auto composition = Composition<int, int, int>::create(TaskPool<int, int>::create(make_probe(), 2), make_probe());
+
+	for (auto& pattern : { single, composition }) {
+		pattern->Init();
+
+		std::promise<std::vector<int>> input{};
+		auto output = pattern->ComputeBatch(input.get_future());
+
+		std::vector<int> inputs(33);
+
+		for (auto i = 0; i < 33; i++) {
+			inputs[i] = i;
+		}
+
+		input.set_value(inputs);
+
+		if (output.get() != inputs) {
+			std::cerr << pattern->Name() << " returned a wrong batch" << std::endl;
+			success = false;
+		}
+
+		pattern->Dispose();
+	}
+
+	return success;
+}